@@ -46,10 +46,20 @@
 #define STATUS_SOAPYSDR_INIT    0x040000 /* SoapySDR device init status     */
 #define TUNER_GAIN_AUTO         0x100000 /* Set tuner gain to auto mode     */
 #define AUTO_DETECT_SDR         0x200000 /* Auto detect SDR device & driver */
+#define DECODE_MEASURE_BER      0x400000 /* Measure BER for signal quality  */
+#define IMAGE_JPEG_LOSSLESS     0x800000 /* Raw JPEGs from DCT coefficients */
 
 /* Number of APID image channels */
 #define CHANNEL_IMAGE_NUM   3
 
+/* Imaging APIDs are 64-69, APID 70 carries telemetry */
+#define APID_IMAGE_FIRST    64
+#define APID_IMAGE_NUM      6
+#define APID_TELEMETRY      70
+
+/* Most worker threads decoding image packets */
+#define DECODE_THREADS_MAX  16
+
 /* Indices for normalization range black and white values */
 #define NORM_RANGE_BLACK    0
 #define NORM_RANGE_WHITE    1
@@ -42,8 +42,7 @@ sem_t demod_semaphore;
 /* Meteor decoder variables */
 bool no_time_yet = true;
 int last_time, first_time;
-ac_table_rec_t *ac_table = NULL;
-size_t ac_table_len;
+huff_table_t huff_dc, huff_ac;
 mtd_rec_t mtd_record;
 
 /* Channel images and sizes */
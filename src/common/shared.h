@@ -45,8 +45,7 @@ extern sem_t demod_semaphore;
 /* Meteor decoder variables */
 extern bool no_time_yet;
 extern int last_time, first_time;
-extern ac_table_rec_t *ac_table;
-extern size_t ac_table_len;
+extern huff_table_t huff_dc, huff_ac;
 extern mtd_rec_t mtd_record;
 
 /* Channel images and sizes */
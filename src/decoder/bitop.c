@@ -22,10 +22,6 @@
 
 /*****************************************************************************/
 
-static inline uint8_t NthByte(uint8_t *l, int n);
-
-/*****************************************************************************/
-
 static const int bitcnt[256] = {
     0, 1, 1, 2, 1, 2, 2, 3,
     1, 2, 2, 3, 2, 3, 3, 4,
@@ -63,92 +59,6 @@ static const int bitcnt[256] = {
 
 /*****************************************************************************/
 
-static inline uint8_t NthByte(uint8_t *l, int n) {
-    return *(l + n);
-}
-
-/*****************************************************************************/
-
-void Bitop_WriterCreate(bit_io_rec_t *w, uint8_t *bytes, int len) {
-    w->p = bytes;
-    w->len = len;
-    w->cur = 0;
-    w->pos = 0;
-    w->cur_len = 0;
-}
-
-/*****************************************************************************/
-
-void Bitop_WriteBitlistReversed(bit_io_rec_t *w, uint8_t *l, int len) {
-    int i, byte_index, close_len, full_bytes;
-    uint16_t b;
-
-    l = &l[len - 1];
-    uint8_t *bytes = w->p;
-    byte_index = w->pos;
-
-    if (w->cur_len != 0) {
-        close_len = 8 - w->cur_len;
-
-        if (close_len >= len)
-            close_len = len;
-
-        b = w->cur;
-
-        for (i = 0; i < close_len; i++) {
-            b  |= l[0];
-            b <<= 1;
-            l  -= 1;
-        }
-
-        len -= close_len;
-
-        if ((w->cur_len + close_len) == 8) {
-            b >>= 1;
-            bytes[byte_index] = (uint8_t)b;
-            byte_index++;
-        }
-        else {
-            w->cur = (uint8_t)b;
-            w->cur_len += close_len;
-            return;
-        }
-    }
-
-    full_bytes = len / 8;
-
-    for (i = 0; i < full_bytes; i++) {
-        bytes[byte_index] = (uint8_t)
-            ((NthByte(l,  0) << 7) |
-             (NthByte(l, -1) << 6) |
-             (NthByte(l, -2) << 5) |
-             (NthByte(l, -3) << 4) |
-             (NthByte(l, -4) << 3) |
-             (NthByte(l, -5) << 2) |
-             (NthByte(l, -6) << 1) |
-             NthByte(l, -7));
-
-        byte_index++;
-        l -= 8;
-    }
-
-    len -= 8 * full_bytes;
-
-    b = 0;
-
-    for (i = 0; i < len; i++) {
-        b |= l[0];
-        b <<= 1;
-        l--;
-    }
-
-    w->cur = (uint8_t)b;
-    w->pos = byte_index;
-    w->cur_len = len;
-}
-
-/*****************************************************************************/
-
 int Bitop_CountBits(uint32_t n) {
     int result =
         bitcnt[n & 0xFF] +
@@ -158,27 +68,3 @@ int Bitop_CountBits(uint32_t n) {
 
     return result;
 }
-
-/*****************************************************************************/
-
-uint32_t Bitop_PeekNBits(bit_io_rec_t *b, const int n) {
-    int bit, i, p;
-    uint32_t result = 0;
-
-    for (i = 0; i < n; i++) {
-        p = b->pos + i;
-        bit = (b->p[p >> 3] >> (7 - (p & 7))) & 0x01;
-        result = (result << 1) | (uint32_t)bit;
-    }
-
-    return result;
-}
-
-/*****************************************************************************/
-
-uint32_t Bitop_FetchNBits(bit_io_rec_t *b, const int n) {
-    uint32_t result = Bitop_PeekNBits(b, n);
-    Bitop_AdvanceNBits(b, n);
-
-    return result;
-}
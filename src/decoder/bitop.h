@@ -20,30 +20,99 @@
 /*****************************************************************************/
 
 #include <stdint.h>
+#include <string.h>
 
 /*****************************************************************************/
 
-/* Bit input-output data */
+/* Bit input data. Bits are read MSB first through a 64 bit
+ * accumulator refilled from p, with zeros past end */
 typedef struct bit_io_rec_t {
-    uint8_t *p;
-    int pos, len;
-    uint8_t cur;
-    int cur_len;
+    const uint8_t *p, *end;
+    uint64_t acc;   /* Buffered bits, next one in the MSB */
+    int acc_len;    /* Number of buffered bits */
+    int pos, len;   /* Bits consumed and total bits */
 } bit_io_rec_t;
 
 /*****************************************************************************/
 
+/* Bitop_Init()
+ *
+ * Sets up a bit reader over len bytes at p
+ */
+static inline void Bitop_Init(bit_io_rec_t *b, const uint8_t *p, int len) {
+    b->p   = p;
+    b->end = p + len;
+    b->acc = 0;
+    b->acc_len = 0;
+    b->pos = 0;
+    b->len = 8 * len;
+}
+
+/*****************************************************************************/
+
+/* Bitop_Refill()
+ *
+ * Tops up the accumulator to at least 56 bits. Away from the end
+ * of data it loads 8 bytes at once and keeps the whole bytes that
+ * fit, otherwise it goes byte by byte and shifts in zeros past end
+ */
+static inline void Bitop_Refill(bit_io_rec_t *b) {
+    uint64_t w;
+
+    if (b->end - b->p >= 8) {
+        memcpy(&w, b->p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        b->acc |= w >> b->acc_len;
+        b->p += (63 - b->acc_len) >> 3;
+        b->acc_len |= 56;
+    }
+    else {
+        while (b->acc_len <= 56) {
+            if (b->p < b->end)
+                b->acc |= (uint64_t)(*b->p++) << (56 - b->acc_len);
+            b->acc_len += 8;
+        }
+    }
+}
+
+/*****************************************************************************/
+
+/* Bitop_PeekNBits()
+ *
+ * Returns the next n (0-32) bits without consuming them
+ */
+static inline uint32_t Bitop_PeekNBits(bit_io_rec_t *b, const int n) {
+    if (b->acc_len < n)
+        Bitop_Refill(b);
+
+    return (uint32_t)((b->acc >> 1) >> (63 - n));
+}
+
+/*****************************************************************************/
+
 static inline void Bitop_AdvanceNBits(bit_io_rec_t *b, const int n) {
+    if (b->acc_len < n)
+        Bitop_Refill(b);
+
+    b->acc <<= n;
+    b->acc_len -= n;
     b->pos += n;
 }
 
 /*****************************************************************************/
 
-void Bitop_WriterCreate(bit_io_rec_t *w, uint8_t *bytes, int len);
-void Bitop_WriteBitlistReversed(bit_io_rec_t *w, uint8_t *l, int len);
+static inline uint32_t Bitop_FetchNBits(bit_io_rec_t *b, const int n) {
+    uint32_t result = Bitop_PeekNBits(b, n);
+    Bitop_AdvanceNBits(b, n);
+
+    return result;
+}
+
+/*****************************************************************************/
+
 int Bitop_CountBits(uint32_t n);
-uint32_t Bitop_PeekNBits(bit_io_rec_t *b, const int n);
-uint32_t Bitop_FetchNBits(bit_io_rec_t *b, const int n);
 
 /*****************************************************************************/
 
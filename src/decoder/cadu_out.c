@@ -0,0 +1,326 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#include "cadu_out.h"
+
+#include "../common/common.h"
+#include "../common/shared.h"
+#include "../mlrpt/utils.h"
+#include "met_to_data.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*****************************************************************************/
+
+/* Sink names with this prefix are Unix sockets, others are files */
+#define SINK_UNIX_PREFIX    "unix:"
+
+/*****************************************************************************/
+
+/* An output stream and where it goes. Sockets don't block, the
+ * rest of a record a socket only took part of waits in pend */
+typedef struct sink_t {
+    int fd;
+    bool is_socket;
+    const char *name;
+    uint8_t pend[CADU_REC_LEN]; /* Fits the longest record */
+    size_t pend_len;
+    uint32_t dropped;
+} sink_t;
+
+/*****************************************************************************/
+
+static bool Sink_Open(sink_t *sink, const char *name);
+static size_t Sink_Send(sink_t *sink, struct iovec **iov, int *iov_cnt);
+static void Sink_Write(sink_t *sink, struct iovec *iov, int iov_cnt);
+static void Sink_Close(sink_t *sink);
+
+/*****************************************************************************/
+
+static const uint8_t asm_bytes[4] = { 0x1A, 0xCF, 0xFC, 0x1D };
+
+static sink_t cadu_sink = { .fd = -1 };
+static sink_t vcdu_sink = { .fd = -1 };
+
+/* Frames written to the VCDU stream in this pass */
+static uint32_t vcdu_seq;
+
+/*****************************************************************************/
+
+/* Sink_Open()
+ *
+ * Opens a sink: connects to a listening Unix stream socket
+ * if name starts with SINK_UNIX_PREFIX, otherwise opens
+ * name as a file, truncating what an earlier pass left. Sockets are made non-blocking,
+ * so that a slow consumer can't hold up demodulation.
+ * Returns false on error
+ */
+static bool Sink_Open(sink_t *sink, const char *name) {
+  struct sockaddr_un addr;
+  char mesg[MESG_SIZE];
+
+  sink->name = name;
+  sink->pend_len = 0;
+  sink->dropped = 0;
+  sink->is_socket = strncmp( name, SINK_UNIX_PREFIX,
+      sizeof(SINK_UNIX_PREFIX) - 1 ) == 0;
+
+  if( sink->is_socket )
+  {
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, name + sizeof(SINK_UNIX_PREFIX) - 1,
+        sizeof(addr.sun_path) - 1 );
+
+    sink->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( (sink->fd >= 0) &&
+        ((connect(sink->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+         (fcntl(sink->fd, F_SETFL, O_NONBLOCK) < 0)) )
+    {
+      close( sink->fd );
+      sink->fd = -1;
+    }
+  }
+  else
+    sink->fd = open( name, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+  if( sink->fd < 0 )
+  {
+    snprintf( mesg, MESG_SIZE,
+        "Failed to open frame output %s: %s", name, strerror(errno) );
+    Print_Message( mesg, ERROR_MESG );
+    return( false );
+  }
+
+  snprintf( mesg, MESG_SIZE, "Writing frames to %s", name );
+  Print_Message( mesg, INFO_MESG );
+
+  return( true );
+}
+
+/*****************************************************************************/
+
+/* Sink_Send()
+ *
+ * Gathers data from the iov buffers straight into the sink,
+ * carrying on after partial writes until all is written or the
+ * socket has no room left. iov and iov_cnt are advanced past what
+ * was written, and the count written is returned. The sink is
+ * closed on error, so that a consumer going away doesn't stop
+ * the decoder
+ */
+static size_t Sink_Send(sink_t *sink, struct iovec **iov, int *iov_cnt) {
+  struct msghdr msg;
+  ssize_t cnt;
+  size_t sent = 0;
+  char mesg[MESG_SIZE];
+
+  while( (sink->fd >= 0) && (*iov_cnt > 0) )
+  {
+    if( sink->is_socket )
+    {
+      //Don't get killed by SIGPIPE if the consumer closes
+      memset( &msg, 0, sizeof(msg) );
+      msg.msg_iov    = *iov;
+      msg.msg_iovlen = (size_t)*iov_cnt;
+      cnt = sendmsg( sink->fd, &msg, MSG_NOSIGNAL );
+    }
+    else
+      cnt = writev( sink->fd, *iov, *iov_cnt );
+
+    if( cnt < 0 )
+    {
+      if( errno == EINTR ) continue;
+      if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) break;
+
+      snprintf( mesg, MESG_SIZE,
+          "Frame output %s failed: %s", sink->name, strerror(errno) );
+      Print_Message( mesg, ERROR_MESG );
+      Sink_Close( sink );
+      break;
+    }
+    sent += (size_t)cnt;
+
+    //Skip what has been written
+    while( (*iov_cnt > 0) && ((size_t)cnt >= (*iov)->iov_len) )
+    {
+      cnt -= (ssize_t)(*iov)->iov_len;
+      (*iov)++;
+      (*iov_cnt)--;
+    }
+
+    if( *iov_cnt > 0 )
+    {
+      (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + cnt;
+      (*iov)->iov_len -= (size_t)cnt;
+    }
+  }
+
+  return( sent );
+}
+
+/*****************************************************************************/
+
+/* Sink_Write()
+ *
+ * Writes a record from the iov buffers to the sink without
+ * waiting. Records are kept whole: the rest of one the socket
+ * only took part of is sent before anything else, and records
+ * that find no room are dropped and counted
+ */
+static void Sink_Write(sink_t *sink, struct iovec *iov, int iov_cnt) {
+  struct iovec pend, *pv = &pend;
+  int pend_cnt = 1;
+  size_t sent;
+
+  if( sink->fd < 0 ) return;
+
+  if( sink->pend_len > 0 )
+  {
+    pend.iov_base = sink->pend;
+    pend.iov_len  = sink->pend_len;
+    sent = Sink_Send( sink, &pv, &pend_cnt );
+    if( sink->fd < 0 ) return;
+
+    sink->pend_len -= sent;
+    memmove( sink->pend, &sink->pend[sent], sink->pend_len );
+    if( sink->pend_len > 0 )
+    {
+      sink->dropped++;
+      return;
+    }
+  }
+
+  sent = Sink_Send( sink, &iov, &iov_cnt );
+  if( (sink->fd < 0) || (iov_cnt == 0) ) return;
+
+  if( sent == 0 )
+  {
+    sink->dropped++;
+    return;
+  }
+
+  //Keep the rest of the record for next time
+  for( ; iov_cnt > 0; iov++, iov_cnt-- )
+  {
+    memcpy( &sink->pend[sink->pend_len], iov->iov_base, iov->iov_len );
+    sink->pend_len += iov->iov_len;
+  }
+}
+
+/*****************************************************************************/
+
+/* Sink_Close()
+ *
+ * Closes a sink, reporting the records it had to drop
+ */
+static void Sink_Close(sink_t *sink) {
+  char mesg[MESG_SIZE];
+
+  if( sink->fd >= 0 )
+    close( sink->fd );
+  sink->fd = -1;
+
+  if( sink->dropped > 0 )
+  {
+    snprintf( mesg, MESG_SIZE,
+        "Frame output %s dropped %u records it had no room for",
+        sink->name, sink->dropped );
+    Print_Message( mesg, ERROR_MESG );
+    sink->dropped = 0;
+  }
+}
+
+/*****************************************************************************/
+
+/* Cadu_Out_Open()
+ *
+ * Opens the CADU and VCDU outputs set in the config, if any
+ */
+void Cadu_Out_Open(void) {
+  Cadu_Out_Close();
+  vcdu_seq = 0;
+
+  if( rc_data.cadu_out[0] != '\0' )
+    Sink_Open( &cadu_sink, rc_data.cadu_out );
+
+  if( rc_data.vcdu_out[0] != '\0' )
+    Sink_Open( &vcdu_sink, rc_data.vcdu_out );
+}
+
+/*****************************************************************************/
+
+/* Cadu_Out_Frame()
+ *
+ * Writes the frame just decoded into mtd->ecced_data to the CADU
+ * output and, if it is good, to the VCDU output. The frame data
+ * is handed to the kernel in place, without copying
+ */
+void Cadu_Out_Frame(const mtd_rec_t *mtd, bool good) {
+  struct iovec iov[2];
+  uint8_t hdr[VCDU_REC_HDR_LEN];
+  uint32_t cnt;
+  const uint8_t *vcdu = mtd->ecced_data;
+
+  if( cadu_sink.fd >= 0 )
+  {
+    iov[0].iov_base = (void *)asm_bytes;
+    iov[0].iov_len  = sizeof(asm_bytes);
+    iov[1].iov_base = (void *)mtd->ecced_data;
+    iov[1].iov_len  = CADU_REC_LEN - sizeof(asm_bytes);
+    Sink_Write( &cadu_sink, iov, 2 );
+  }
+
+  if( !good || (vcdu_sink.fd < 0) ) return;
+
+  cnt = ((uint32_t)vcdu[2] << 16) | ((uint32_t)vcdu[3] << 8) | vcdu[4];
+  hdr[0] = (uint8_t)( cnt >> 24 );
+  hdr[1] = (uint8_t)( cnt >> 16 );
+  hdr[2] = (uint8_t)( cnt >>  8 );
+  hdr[3] = (uint8_t)( cnt );
+  hdr[4] = (uint8_t)( vcdu_seq >> 24 );
+  hdr[5] = (uint8_t)( vcdu_seq >> 16 );
+  hdr[6] = (uint8_t)( vcdu_seq >>  8 );
+  hdr[7] = (uint8_t)( vcdu_seq );
+  hdr[8] = isFlagSet( DECODE_MEASURE_BER ) ? (uint8_t)mtd->sig_q : 255;
+  hdr[9] = 0;
+  hdr[10] = (uint8_t)( VCDU_REC_LEN >> 8 );
+  hdr[11] = (uint8_t)( VCDU_REC_LEN & 0xFF );
+  vcdu_seq++;
+
+  iov[0].iov_base = hdr;
+  iov[0].iov_len  = VCDU_REC_HDR_LEN;
+  iov[1].iov_base = (void *)vcdu;
+  iov[1].iov_len  = VCDU_REC_LEN;
+  Sink_Write( &vcdu_sink, iov, 2 );
+}
+
+/*****************************************************************************/
+
+void Cadu_Out_Close(void) {
+  Sink_Close( &cadu_sink );
+  Sink_Close( &vcdu_sink );
+}
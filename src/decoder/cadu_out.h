@@ -0,0 +1,52 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#ifndef DECODER_CADU_OUT_H
+#define DECODER_CADU_OUT_H
+
+/*****************************************************************************/
+
+#include "met_to_data.h"
+
+#include <stdbool.h>
+
+/*****************************************************************************/
+
+/* Frame output streams for external processors. The CADU stream
+ * is made of 1024 byte records: the ASM followed by the derandomised
+ * and error corrected (where possible) RS codeblock. The VCDU stream
+ * is made of VCDU_REC_HDR_LEN byte headers, each followed by a good
+ * VCDU of VCDU_REC_LEN bytes. All header fields are big endian:
+ *
+ *   0  uint32  VCDU frame counter
+ *   4  uint32  Sequence number of the frame in this pass
+ *   8  uint8   Signal quality 0-100 (255 if BER isn't measured)
+ *   9  uint8   Reserved (0)
+ *  10  uint16  VCDU length
+ */
+#define CADU_REC_LEN        1024
+#define VCDU_REC_HDR_LEN    12
+#define VCDU_REC_LEN        (HARD_FRAME_LEN - 132)
+
+/*****************************************************************************/
+
+void Cadu_Out_Open(void);
+void Cadu_Out_Frame(const mtd_rec_t *mtd, bool good);
+void Cadu_Out_Close(void);
+
+/*****************************************************************************/
+
+#endif
@@ -19,6 +19,10 @@
 #include <stdint.h>
 #include <strings.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*****************************************************************************/
 
 #define CORR_LIMIT  55
@@ -30,33 +34,22 @@ static uint64_t Rotate_IQ_QW(uint64_t data, int shift);
 static uint64_t Flip_IQ_QW(uint64_t data);
 static void Corr_Set_Patt(corr_rec_t *c, int n, uint64_t p);
 static void Corr_Reset(corr_rec_t *c);
+static inline uint64_t Slice_Word(const uint8_t *data, uint32_t len);
 
 /*****************************************************************************/
 
 static uint8_t rotate_iq_tab[256];
 static uint8_t invert_iq_tab[256];
-static int corr_tab[256][256];
-
-/*****************************************************************************/
-
-int Hard_Correlate(const uint8_t d, const uint8_t w) {
-    return corr_tab[d][w];
-}
 
 /*****************************************************************************/
 
 void Init_Correlator_Tables(void) {
-  int i, j;
+  int i;
 
   for( i = 0; i <= 255; i++ )
   {
     rotate_iq_tab[i] = (uint8_t)( (((i & 0x55) ^ 0x55) << 1) | ((i & 0xAA) >> 1) );
     invert_iq_tab[i] = (uint8_t)( ( (i & 0x55)         << 1) | ((i & 0xAA) >> 1) );
-
-    //Correlation between a soft sample i and a hard value j
-    for( j = 0; j <= 255; j++ )
-      corr_tab[i][j] =
-        (int)( ((i > 127) && (j == 0)) || ((i <= 127) && (j == 255)) );
   }
 }
 
@@ -109,59 +102,17 @@ static uint64_t Flip_IQ_QW(uint64_t data) {
 
 /*****************************************************************************/
 
-void Fix_Packet(void *data, int len, int shift) {
-  int j;
-  int8_t *d;
-  int8_t b;
-
-  d = (int8_t *)data;
-  switch( shift )
-  {
-    case 4:
-      for( j = 0; j < len / 2; j++ )
-      {
-        b = d[j * 2 + 0];
-        d[j * 2 + 0] = d[j * 2 + 1];
-        d[j * 2 + 1] = b;
-      }
-      break;
-
-    case 5:
-      for( j = 0; j < len / 2; j++ )
-      {
-        d[j * 2 + 0] = -d[j * 2 + 0];
-      }
-      break;
-
-    case 6:
-      for( j = 0; j < len / 2; j++ )
-      {
-        b = d[ j * 2 + 0];
-        d[j * 2 + 0] = -d[j * 2 + 1];
-        d[j * 2 + 1] = -b;
-      }
-      break;
-
-    case 7:
-      for( j = 0; j < len / 2; j++ )
-      {
-        d[j * 2 + 1] = -d[j * 2 + 1];
-      }
-  }
-}
-
-/*****************************************************************************/
-
+/* Corr_Set_Patt()
+ *
+ * Stores pattern p bit-reversed, so that the
+ * first symbol of the pattern is in the LSB
+ */
 static void Corr_Set_Patt(corr_rec_t *c, int n, uint64_t p) {
   int i;
 
+  c->patts[n] = 0;
   for( i = 0; i < PATTERN_SIZE; i++ )
-  {
-    if( ((p >> (PATTERN_SIZE - i - 1)) & 1) != 0 )
-      c->patts[i][n] = 0xFF;
-    else
-      c->patts[i][n] = 0;
-  }
+    c->patts[n] |= ((p >> (PATTERN_SIZE - i - 1)) & 1) << i;
 }
 
 /*****************************************************************************/
@@ -190,38 +141,73 @@ static void Corr_Reset(corr_rec_t *c) {
 
 /*****************************************************************************/
 
+/* Slice_Word()
+ *
+ * Hard-slices up to 64 soft symbols into their sign bits,
+ * the first symbol going to the LSB of the returned word
+ */
+static inline uint64_t Slice_Word(const uint8_t *data, uint32_t len) {
+  uint32_t i;
+  uint64_t result = 0;
+
+#ifdef __SSE2__
+  if( len >= 64 )
+  {
+    for( i = 0; i < 4; i++ )
+      result |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+          _mm_loadu_si128((const __m128i *)&data[16 * i]) ) << (16 * i);
+
+    return( result );
+  }
+#endif
+
+  if( len > 64 ) len = 64;
+  for( i = 0; i < len; i++ )
+    result |= (uint64_t)(data[i] >> 7) << i;
+
+  return( result );
+}
+
+/*****************************************************************************/
+
+/* Corr_Correlate()
+ *
+ * Slides all patterns over the sign bits of the soft symbols in data,
+ * 64 symbols at a time, counting matches with XOR and popcount. Returns
+ * the first pattern to exceed CORR_LIMIT or else the best matching one
+ */
 int Corr_Correlate(corr_rec_t *c, uint8_t *data, uint32_t len) {
-  int i, n, k;
-  int *d;
-  uint8_t *p;
+  int n, k;
+  uint32_t i, s;
+  uint64_t cur, next, window;
 
   int result = -1;
   Corr_Reset( c );
 
-  for( i = 0; (uint32_t)i < (len - PATTERN_SIZE); i++ )
+  cur  = Slice_Word( data, len );
+  next = Slice_Word( &data[PATTERN_SIZE], len - PATTERN_SIZE );
+
+  for( i = 0; i < (len - PATTERN_SIZE); i++ )
   {
-    for( n = 0; n < PATTERN_CNT; n++ )
-      c->tmp_corr[n] = 0;
-    for( k = 0; k < PATTERN_SIZE; k++ )
+    s = i % PATTERN_SIZE;
+    if( (s == 0) && (i != 0) )
     {
-      d = &(corr_tab[ data[i + k] ] [0]);
-      p = &(c->patts[k][0]);
-      //Unrolled to pattern_cnt times
-      c->tmp_corr[0] += d[p[0]];
-      c->tmp_corr[1] += d[p[1]];
-      c->tmp_corr[2] += d[p[2]];
-      c->tmp_corr[3] += d[p[3]];
-      c->tmp_corr[4] += d[p[4]];
-      c->tmp_corr[5] += d[p[5]];
-      c->tmp_corr[6] += d[p[6]];
-      c->tmp_corr[7] += d[p[7]];
+      cur  = next;
+      next = Slice_Word( &data[i + PATTERN_SIZE], len - i - PATTERN_SIZE );
     }
 
+    window = cur;
+    if( s != 0 )
+      window = (cur >> s) | (next << (PATTERN_SIZE - s));
+
+    for( n = 0; n < PATTERN_CNT; n++ )
+      c->tmp_corr[n] = __builtin_popcountll( window ^ c->patts[n] );
+
     for( n = 0; n < PATTERN_CNT; n++ )
       if( c->tmp_corr[n] > c->correlation[n] )
       {
         c->correlation[n] = c->tmp_corr[n];
-        c->position[n] = i;
+        c->position[n] = (int)i;
         c->tmp_corr[n] = 0;
         if( c->correlation[n] > CORR_LIMIT )
         {
@@ -232,11 +218,11 @@ int Corr_Correlate(corr_rec_t *c, uint8_t *data, uint32_t len) {
   }
 
   k = 0;
-  for( i = 0; i < PATTERN_CNT; i++ )
-    if( c->correlation[i] > k )
+  for( n = 0; n < PATTERN_CNT; n++ )
+    if( c->correlation[n] > k )
     {
-      result = i;
-      k = c->correlation[i];
+      result = n;
+      k = c->correlation[n];
     }
 
   return( result );
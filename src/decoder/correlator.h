@@ -30,7 +30,8 @@
 
 /* Decoder correlator data */
 typedef struct corr_rec_t {
-    uint8_t patts[PATTERN_SIZE][PATTERN_SIZE];
+    /* Hard patterns, one bit per symbol */
+    uint64_t patts[PATTERN_CNT];
 
     int
         correlation[PATTERN_CNT],
@@ -40,9 +41,41 @@ typedef struct corr_rec_t {
 
 /*****************************************************************************/
 
-int Hard_Correlate(const uint8_t d, const uint8_t w);
+/* Fix_Pair()
+ *
+ * Undoes the IQ swap/negation of a soft symbol pair that the
+ * correlator found as pattern shift. Negation is done on ints,
+ * so that -128 becomes +128 instead of wrapping around
+ */
+static inline void Fix_Pair(int shift, int *y0, int *y1) {
+    int b;
+
+    switch (shift) {
+        case 4:
+            b = *y0;
+            *y0 = *y1;
+            *y1 = b;
+            break;
+
+        case 5:
+            *y0 = -*y0;
+            break;
+
+        case 6:
+            b = *y0;
+            *y0 = -*y1;
+            *y1 = -b;
+            break;
+
+        case 7:
+            *y1 = -*y1;
+            break;
+    }
+}
+
+/*****************************************************************************/
+
 void Init_Correlator_Tables(void);
-void Fix_Packet(void *data, int len, int shift);
 void Correlator_Init(corr_rec_t *c, uint64_t q);
 int Corr_Correlate(corr_rec_t *c, uint8_t *data, uint32_t len);
 
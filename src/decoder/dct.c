@@ -16,19 +16,138 @@
 
 #include "dct.h"
 
+#include "../common/common.h"
+#include "../mlrpt/utils.h"
+
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IDCT_HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+/*****************************************************************************/
+
+/* Fixed point IDCT. Coefficients carry IDCT_FRAC_BITS fraction bits
+ * through both passes, multiplications keep the high 16 bits of a
+ * product with an IDCT_CONST_BITS constant, as SSE2 pmulhw does */
+#define IDCT_FRAC_BITS      2
+#define IDCT_CONST_BITS     14
+#define IDCT_SCALE_BITS     14
+#define IDCT_OUT_SHIFT      (IDCT_FRAC_BITS + 3)
+
+#define FIX_1_414213562     23170
+#define FIX_1_847759065     30274
+#define FIX_1_082392200     17734
+#define FIX_0_613125930     10045
+
+/* Blocks and rounds per path of the SIMD self-check in Idct_Init() */
+#define IDCT_CHECK_BLOCKS   5
+#define IDCT_CHECK_ROUNDS   32
+
+/* Blocks of the fixed against float accuracy check in Idct_Init(),
+ * and the largest pixel error it lets through without complaint */
+#define IDCT_ACCURACY_BLOCKS    4096
+#define IDCT_ACCURACY_ERROR     2
+
+/* Highest zig-zag index of a non-zero coefficient of blocks that
+ * take the 2x2 and 4x4 paths, with all non-zero coefficients in the
+ * top left 2x2 or 4x4 corner. Lower indices are the DC-only path */
+#define IDCT_LAST_2X2       2
+#define IDCT_LAST_4X4       9
 
 /*****************************************************************************/
 
 static void Init_Cos(void);
+static void Flt_Idct_8x8(double *res, const double *inpt);
+static void Idct_Accuracy(void);
+static inline int16_t Mul_Fix(int16_t x, int16_t k);
+static inline void Idct_Aan(int16_t *d);
+static inline void Idct_Aan4(int16_t *d);
+static inline void Idct_Aan2(int16_t *d);
+static inline void Idct_Aan_Sized(int16_t *d, int size);
+static void Idct_DC(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        uint8_t *out,
+        int stride,
+        uint8_t inv);
+static void Idct_Scalar(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv);
+#ifdef IDCT_HAVE_SIMD
+static void Idct_SSE2(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) __attribute__((target("sse2")));
+static void Idct_AVX2(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) __attribute__((target("avx2")));
+static bool Idct_Check(void (*idct)(
+            const int16_t (*coef)[64],
+            const int16_t *dqs,
+            int n,
+            int size,
+            uint8_t *out,
+            int stride,
+            uint8_t inv));
+#endif
+static inline int Idct_Path(uint8_t last);
 
 /*****************************************************************************/
 
 static double cosine[8][8];
 static double alpha[8];
 
+/* AAN scale factors, c(u) * c(v) * 2^IDCT_SCALE_BITS where
+ * c(0) = 1 and c(k) = cos(k * pi / 16) * sqrt(2) */
+static const uint16_t aan_scale[64] = {
+    16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+    22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+    21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906,
+    19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+    16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+    12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+     8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,
+     4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+};
+
+/* IDCT kernel, selected in Idct_Init(). Blocks must have
+ * their non-zero coefficients in the top left size x size
+ * corner, where size is 2, 4 or 8 */
+static void (*Idct)(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) = Idct_Scalar;
+
+/* Blocks that took each IDCT path since Idct_Init(),
+ * counted atomically as packets decode on many threads */
+static uint32_t path_cnt[IDCT_PATHS];
+
 /*****************************************************************************/
 
 static void Init_Cos(void) {
@@ -51,7 +170,12 @@ static void Init_Cos(void) {
 
 /*****************************************************************************/
 
-void Flt_Idct_8x8(double *res, const double *inpt) {
+/* Flt_Idct_8x8()
+ *
+ * Floating point IDCT, straight from its definition, which
+ * Idct_Accuracy() holds the fixed point kernels up to
+ */
+static void Flt_Idct_8x8(double *res, const double *inpt) {
     Init_Cos();
 
     for (uint8_t y = 0; y < 8; y++)
@@ -80,3 +204,758 @@ void Flt_Idct_8x8(double *res, const double *inpt) {
             res[y * 8 + x] = s / 4.0;
         }
 }
+
+/*****************************************************************************/
+
+/* Mul_Fix()
+ *
+ * Multiplies x by the fixed point constant k, in 16 bits throughout
+ */
+static inline int16_t Mul_Fix(int16_t x, int16_t k) {
+    int16_t xs = (int16_t)(x * (1 << (16 - IDCT_CONST_BITS)));
+
+    return (int16_t)(((int32_t)xs * k) >> 16);
+}
+
+/*****************************************************************************/
+
+/* Idct_Aan()
+ *
+ * In place 8 point AAN IDCT of AAN scaled inputs, in 16 bit arithmetic
+ */
+static inline void Idct_Aan(int16_t *d) {
+    int16_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int16_t tmp10, tmp11, tmp12, tmp13;
+    int16_t z5, z10, z11, z12, z13;
+
+    /* Even part */
+    tmp10 = (int16_t)(d[0] + d[4]);
+    tmp11 = (int16_t)(d[0] - d[4]);
+    tmp13 = (int16_t)(d[2] + d[6]);
+    tmp12 = (int16_t)(Mul_Fix((int16_t)(d[2] - d[6]), FIX_1_414213562) - tmp13);
+
+    tmp0 = (int16_t)(tmp10 + tmp13);
+    tmp3 = (int16_t)(tmp10 - tmp13);
+    tmp1 = (int16_t)(tmp11 + tmp12);
+    tmp2 = (int16_t)(tmp11 - tmp12);
+
+    /* Odd part */
+    z13 = (int16_t)(d[5] + d[3]);
+    z10 = (int16_t)(d[5] - d[3]);
+    z11 = (int16_t)(d[1] + d[7]);
+    z12 = (int16_t)(d[1] - d[7]);
+
+    tmp7  = (int16_t)(z11 + z13);
+    tmp11 = Mul_Fix((int16_t)(z11 - z13), FIX_1_414213562);
+
+    z5    = Mul_Fix((int16_t)(z10 + z12), FIX_1_847759065);
+    tmp10 = (int16_t)(Mul_Fix(z12, FIX_1_082392200) - z5);
+
+    /* z10 * -2.613125930, with the constant split to fit 16 bits */
+    tmp12 = (int16_t)(z5 - z10 - z10 - Mul_Fix(z10, FIX_0_613125930));
+
+    tmp6 = (int16_t)(tmp12 - tmp7);
+    tmp5 = (int16_t)(tmp11 - tmp6);
+    tmp4 = (int16_t)(tmp10 + tmp5);
+
+    d[0] = (int16_t)(tmp0 + tmp7);
+    d[7] = (int16_t)(tmp0 - tmp7);
+    d[1] = (int16_t)(tmp1 + tmp6);
+    d[6] = (int16_t)(tmp1 - tmp6);
+    d[2] = (int16_t)(tmp2 + tmp5);
+    d[5] = (int16_t)(tmp2 - tmp5);
+    d[4] = (int16_t)(tmp3 + tmp4);
+    d[3] = (int16_t)(tmp3 - tmp4);
+}
+
+/*****************************************************************************/
+
+/* Idct_Aan4()
+ *
+ * Idct_Aan() of inputs with d[4] to d[7] zero
+ */
+static inline void Idct_Aan4(int16_t *d) {
+    int16_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int16_t tmp10, tmp11, tmp12;
+    int16_t z5, z10;
+
+    /* Even part */
+    tmp12 = (int16_t)(Mul_Fix(d[2], FIX_1_414213562) - d[2]);
+
+    tmp0 = (int16_t)(d[0] + d[2]);
+    tmp3 = (int16_t)(d[0] - d[2]);
+    tmp1 = (int16_t)(d[0] + tmp12);
+    tmp2 = (int16_t)(d[0] - tmp12);
+
+    /* Odd part */
+    z10 = (int16_t)(-d[3]);
+
+    tmp7  = (int16_t)(d[1] + d[3]);
+    tmp11 = Mul_Fix((int16_t)(d[1] - d[3]), FIX_1_414213562);
+
+    z5    = Mul_Fix((int16_t)(d[1] - d[3]), FIX_1_847759065);
+    tmp10 = (int16_t)(Mul_Fix(d[1], FIX_1_082392200) - z5);
+    tmp12 = (int16_t)(z5 - z10 - z10 - Mul_Fix(z10, FIX_0_613125930));
+
+    tmp6 = (int16_t)(tmp12 - tmp7);
+    tmp5 = (int16_t)(tmp11 - tmp6);
+    tmp4 = (int16_t)(tmp10 + tmp5);
+
+    d[0] = (int16_t)(tmp0 + tmp7);
+    d[7] = (int16_t)(tmp0 - tmp7);
+    d[1] = (int16_t)(tmp1 + tmp6);
+    d[6] = (int16_t)(tmp1 - tmp6);
+    d[2] = (int16_t)(tmp2 + tmp5);
+    d[5] = (int16_t)(tmp2 - tmp5);
+    d[4] = (int16_t)(tmp3 + tmp4);
+    d[3] = (int16_t)(tmp3 - tmp4);
+}
+
+/*****************************************************************************/
+
+/* Idct_Aan2()
+ *
+ * Idct_Aan() of inputs with d[2] to d[7] zero
+ */
+static inline void Idct_Aan2(int16_t *d) {
+    int16_t tmp0, tmp4, tmp5, tmp6, tmp7;
+    int16_t tmp10, tmp11;
+    int16_t z5;
+
+    tmp0 = d[0];
+    tmp7 = d[1];
+
+    tmp11 = Mul_Fix(d[1], FIX_1_414213562);
+    z5    = Mul_Fix(d[1], FIX_1_847759065);
+    tmp10 = (int16_t)(Mul_Fix(d[1], FIX_1_082392200) - z5);
+
+    tmp6 = (int16_t)(z5 - tmp7);
+    tmp5 = (int16_t)(tmp11 - tmp6);
+    tmp4 = (int16_t)(tmp10 + tmp5);
+
+    d[0] = (int16_t)(tmp0 + tmp7);
+    d[7] = (int16_t)(tmp0 - tmp7);
+    d[1] = (int16_t)(tmp0 + tmp6);
+    d[6] = (int16_t)(tmp0 - tmp6);
+    d[2] = (int16_t)(tmp0 + tmp5);
+    d[5] = (int16_t)(tmp0 - tmp5);
+    d[4] = (int16_t)(tmp0 + tmp4);
+    d[3] = (int16_t)(tmp0 - tmp4);
+}
+
+/*****************************************************************************/
+
+static inline void Idct_Aan_Sized(int16_t *d, int size) {
+    if (size == 8)
+        Idct_Aan(d);
+    else if (size == 4)
+        Idct_Aan4(d);
+    else
+        Idct_Aan2(d);
+}
+
+/*****************************************************************************/
+
+/* Idct_Scale_Dqt()
+ *
+ * Folds the AAN scale factors and IDCT_FRAC_BITS into the
+ * dequantisation table dqt, both in natural order. Idct_8x8()
+ * multiplies the quantised coefficients by it, in 16 bits, as
+ * it loads them
+ */
+void Idct_Scale_Dqt(int16_t *dqs, const int *dqt) {
+    for (int i = 0; i < 64; i++) {
+        int32_t v = (dqt[i] * (int32_t)aan_scale[i] +
+                (1 << (IDCT_SCALE_BITS - IDCT_FRAC_BITS - 1))) >>
+            (IDCT_SCALE_BITS - IDCT_FRAC_BITS);
+
+        dqs[i] = (int16_t)(v > INT16_MAX ? INT16_MAX : v);
+    }
+}
+
+/*****************************************************************************/
+
+/* Idct_DC()
+ *
+ * Transforms blocks with only a DC coefficient, which become flat.
+ * The value is the one the full IDCT arrives at
+ */
+static void Idct_DC(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) {
+    int b, i, v;
+
+    for (b = 0; b < n; b++, out += 8) {
+        v = (int16_t)((int16_t)(coef[b][0] * dqs[0]) +
+                (128 << IDCT_OUT_SHIFT) + (1 << (IDCT_OUT_SHIFT - 1)));
+        v >>= IDCT_OUT_SHIFT;
+        v = v < 0 ? 0 : (v > 255 ? 255 : v);
+
+        for (i = 0; i < 8; i++)
+            memset(&out[i * stride], v ^ inv, 8);
+    }
+}
+
+/*****************************************************************************/
+
+/* Idct_Scalar()
+ *
+ * Reference fixed point kernel of Idct_8x8(), which
+ * the SIMD kernels must match bit for bit. Columns
+ * past size are zero and skipped in the first pass
+ */
+static void Idct_Scalar(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) {
+    int16_t ws[64], d[8];
+    int b, i, j, v;
+
+    for (b = 0; b < n; b++, out += 8) {
+        /* Pass 1: columns */
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++)
+                d[j] = (int16_t)(coef[b][j * 8 + i] * dqs[j * 8 + i]);
+
+            Idct_Aan_Sized(d, size);
+
+            for (j = 0; j < 8; j++)
+                ws[j * 8 + i] = d[j];
+        }
+
+        /* Pass 2: rows. Every output gets the row's DC term, so
+         * the level shift and rounding are added to that alone */
+        for (i = 0; i < 8; i++) {
+            for (j = 0; j < size; j++)
+                d[j] = ws[i * 8 + j];
+
+            d[0] = (int16_t)(d[0] + (128 << IDCT_OUT_SHIFT) +
+                    (1 << (IDCT_OUT_SHIFT - 1)));
+            Idct_Aan_Sized(d, size);
+
+            for (j = 0; j < 8; j++) {
+                v = d[j] >> IDCT_OUT_SHIFT;
+                v = v < 0 ? 0 : (v > 255 ? 255 : v);
+                out[i * stride + j] = (uint8_t)(v ^ inv);
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+
+#ifdef IDCT_HAVE_SIMD
+
+/* The SIMD kernels hold a block in 8 vectors of 8 int16 lanes, one row
+ * or column each. Lane-wise butterflies transform all columns at once,
+ * then after a transpose all rows. The AVX2 kernel carries a second
+ * block in the upper 128 bit lane, which the unpacks keep separate.
+ * Inputs past size are zero in both passes and left out */
+
+#define IDCT_AAN_SIMD(T, P) \
+    do { \
+        T tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+        T tmp10, tmp11, tmp12, tmp13; \
+        T z5, z10, z11, z12, z13; \
+        \
+        tmp10 = P##_add_epi16(v[0], v[4]); \
+        tmp11 = P##_sub_epi16(v[0], v[4]); \
+        tmp13 = P##_add_epi16(v[2], v[6]); \
+        tmp12 = P##_sub_epi16(P##_mulhi_epi16(P##_slli_epi16( \
+                        P##_sub_epi16(v[2], v[6]), 2), k1414), tmp13); \
+        \
+        tmp0 = P##_add_epi16(tmp10, tmp13); \
+        tmp3 = P##_sub_epi16(tmp10, tmp13); \
+        tmp1 = P##_add_epi16(tmp11, tmp12); \
+        tmp2 = P##_sub_epi16(tmp11, tmp12); \
+        \
+        z13 = P##_add_epi16(v[5], v[3]); \
+        z10 = P##_sub_epi16(v[5], v[3]); \
+        z11 = P##_add_epi16(v[1], v[7]); \
+        z12 = P##_sub_epi16(v[1], v[7]); \
+        \
+        tmp7  = P##_add_epi16(z11, z13); \
+        tmp11 = P##_mulhi_epi16(P##_slli_epi16( \
+                    P##_sub_epi16(z11, z13), 2), k1414); \
+        z5    = P##_mulhi_epi16(P##_slli_epi16( \
+                    P##_add_epi16(z10, z12), 2), k1847); \
+        tmp10 = P##_sub_epi16(P##_mulhi_epi16( \
+                    P##_slli_epi16(z12, 2), k1082), z5); \
+        tmp12 = P##_sub_epi16(P##_sub_epi16(P##_sub_epi16(z5, z10), z10), \
+                P##_mulhi_epi16(P##_slli_epi16(z10, 2), k0613)); \
+        \
+        tmp6 = P##_sub_epi16(tmp12, tmp7); \
+        tmp5 = P##_sub_epi16(tmp11, tmp6); \
+        tmp4 = P##_add_epi16(tmp10, tmp5); \
+        \
+        v[0] = P##_add_epi16(tmp0, tmp7); \
+        v[7] = P##_sub_epi16(tmp0, tmp7); \
+        v[1] = P##_add_epi16(tmp1, tmp6); \
+        v[6] = P##_sub_epi16(tmp1, tmp6); \
+        v[2] = P##_add_epi16(tmp2, tmp5); \
+        v[5] = P##_sub_epi16(tmp2, tmp5); \
+        v[4] = P##_add_epi16(tmp3, tmp4); \
+        v[3] = P##_sub_epi16(tmp3, tmp4); \
+    } while (0)
+
+
+#define IDCT_AAN4_SIMD(T, P) \
+    do { \
+        T tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+        T tmp10, tmp11, tmp12; \
+        T z5, z10; \
+        \
+        tmp12 = P##_sub_epi16(P##_mulhi_epi16( \
+                    P##_slli_epi16(v[2], 2), k1414), v[2]); \
+        \
+        tmp0 = P##_add_epi16(v[0], v[2]); \
+        tmp3 = P##_sub_epi16(v[0], v[2]); \
+        tmp1 = P##_add_epi16(v[0], tmp12); \
+        tmp2 = P##_sub_epi16(v[0], tmp12); \
+        \
+        z10 = P##_sub_epi16(zero, v[3]); \
+        \
+        tmp7  = P##_add_epi16(v[1], v[3]); \
+        tmp11 = P##_mulhi_epi16(P##_slli_epi16( \
+                    P##_sub_epi16(v[1], v[3]), 2), k1414); \
+        z5    = P##_mulhi_epi16(P##_slli_epi16( \
+                    P##_sub_epi16(v[1], v[3]), 2), k1847); \
+        tmp10 = P##_sub_epi16(P##_mulhi_epi16( \
+                    P##_slli_epi16(v[1], 2), k1082), z5); \
+        tmp12 = P##_sub_epi16(P##_sub_epi16(P##_sub_epi16(z5, z10), z10), \
+                P##_mulhi_epi16(P##_slli_epi16(z10, 2), k0613)); \
+        \
+        tmp6 = P##_sub_epi16(tmp12, tmp7); \
+        tmp5 = P##_sub_epi16(tmp11, tmp6); \
+        tmp4 = P##_add_epi16(tmp10, tmp5); \
+        \
+        v[0] = P##_add_epi16(tmp0, tmp7); \
+        v[7] = P##_sub_epi16(tmp0, tmp7); \
+        v[1] = P##_add_epi16(tmp1, tmp6); \
+        v[6] = P##_sub_epi16(tmp1, tmp6); \
+        v[2] = P##_add_epi16(tmp2, tmp5); \
+        v[5] = P##_sub_epi16(tmp2, tmp5); \
+        v[4] = P##_add_epi16(tmp3, tmp4); \
+        v[3] = P##_sub_epi16(tmp3, tmp4); \
+    } while (0)
+
+#define IDCT_AAN2_SIMD(T, P) \
+    do { \
+        T tmp0, tmp4, tmp5, tmp6, tmp7; \
+        T tmp10, tmp11; \
+        T z5; \
+        \
+        tmp0 = v[0]; \
+        tmp7 = v[1]; \
+        \
+        tmp11 = P##_mulhi_epi16(P##_slli_epi16(v[1], 2), k1414); \
+        z5    = P##_mulhi_epi16(P##_slli_epi16(v[1], 2), k1847); \
+        tmp10 = P##_sub_epi16(P##_mulhi_epi16( \
+                    P##_slli_epi16(v[1], 2), k1082), z5); \
+        \
+        tmp6 = P##_sub_epi16(z5, tmp7); \
+        tmp5 = P##_sub_epi16(tmp11, tmp6); \
+        tmp4 = P##_add_epi16(tmp10, tmp5); \
+        \
+        v[0] = P##_add_epi16(tmp0, tmp7); \
+        v[7] = P##_sub_epi16(tmp0, tmp7); \
+        v[1] = P##_add_epi16(tmp0, tmp6); \
+        v[6] = P##_sub_epi16(tmp0, tmp6); \
+        v[2] = P##_add_epi16(tmp0, tmp5); \
+        v[5] = P##_sub_epi16(tmp0, tmp5); \
+        v[4] = P##_add_epi16(tmp0, tmp4); \
+        v[3] = P##_sub_epi16(tmp0, tmp4); \
+    } while (0)
+
+#define IDCT_AAN_SIZED_SIMD(T, P) \
+    do { \
+        if (size == 8) \
+            IDCT_AAN_SIMD(T, P); \
+        else if (size == 4) \
+            IDCT_AAN4_SIMD(T, P); \
+        else \
+            IDCT_AAN2_SIMD(T, P); \
+    } while (0)
+
+#define IDCT_TRANSPOSE_SIMD(T, P) \
+    do { \
+        T a0, a1, a2, a3, a4, a5, a6, a7; \
+        \
+        a0 = P##_unpacklo_epi16(v[0], v[1]); \
+        a1 = P##_unpackhi_epi16(v[0], v[1]); \
+        a2 = P##_unpacklo_epi16(v[2], v[3]); \
+        a3 = P##_unpackhi_epi16(v[2], v[3]); \
+        a4 = P##_unpacklo_epi16(v[4], v[5]); \
+        a5 = P##_unpackhi_epi16(v[4], v[5]); \
+        a6 = P##_unpacklo_epi16(v[6], v[7]); \
+        a7 = P##_unpackhi_epi16(v[6], v[7]); \
+        \
+        v[0] = P##_unpacklo_epi32(a0, a2); \
+        v[1] = P##_unpackhi_epi32(a0, a2); \
+        v[2] = P##_unpacklo_epi32(a1, a3); \
+        v[3] = P##_unpackhi_epi32(a1, a3); \
+        v[4] = P##_unpacklo_epi32(a4, a6); \
+        v[5] = P##_unpackhi_epi32(a4, a6); \
+        v[6] = P##_unpacklo_epi32(a5, a7); \
+        v[7] = P##_unpackhi_epi32(a5, a7); \
+        \
+        a0 = P##_unpacklo_epi64(v[0], v[4]); \
+        a1 = P##_unpackhi_epi64(v[0], v[4]); \
+        a2 = P##_unpacklo_epi64(v[1], v[5]); \
+        a3 = P##_unpackhi_epi64(v[1], v[5]); \
+        a4 = P##_unpacklo_epi64(v[2], v[6]); \
+        a5 = P##_unpackhi_epi64(v[2], v[6]); \
+        a6 = P##_unpacklo_epi64(v[3], v[7]); \
+        a7 = P##_unpackhi_epi64(v[3], v[7]); \
+        \
+        v[0] = a0; v[1] = a1; v[2] = a2; v[3] = a3; \
+        v[4] = a4; v[5] = a5; v[6] = a6; v[7] = a7; \
+    } while (0)
+
+/*****************************************************************************/
+
+/* Idct_SSE2()
+ *
+ * SSE2 kernel of Idct_8x8(), one block at a time
+ */
+static void Idct_SSE2(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) {
+    const __m128i k1414 = _mm_set1_epi16(FIX_1_414213562);
+    const __m128i k1847 = _mm_set1_epi16(FIX_1_847759065);
+    const __m128i k1082 = _mm_set1_epi16(FIX_1_082392200);
+    const __m128i k0613 = _mm_set1_epi16(FIX_0_613125930);
+    const __m128i bias  = _mm_set1_epi16(
+            (128 << IDCT_OUT_SHIFT) + (1 << (IDCT_OUT_SHIFT - 1)));
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i vinv  = _mm_set1_epi8((char)inv);
+    __m128i v[8], p;
+    int b, i;
+
+    for (b = 0; b < n; b++, out += 8) {
+        for (i = 0; i < 8; i++)
+            v[i] = i < size ? _mm_mullo_epi16(
+                    _mm_loadu_si128((const __m128i *)&coef[b][i * 8]),
+                    _mm_loadu_si128((const __m128i *)&dqs[i * 8])) : zero;
+
+        IDCT_AAN_SIZED_SIMD(__m128i, _mm);
+        IDCT_TRANSPOSE_SIMD(__m128i, _mm);
+
+        v[0] = _mm_add_epi16(v[0], bias);
+        IDCT_AAN_SIZED_SIMD(__m128i, _mm);
+        IDCT_TRANSPOSE_SIMD(__m128i, _mm);
+
+        /* Two rows at a time, packing clamps to 0-255 */
+        for (i = 0; i < 8; i += 2) {
+            p = _mm_xor_si128(_mm_packus_epi16(
+                    _mm_srai_epi16(v[i], IDCT_OUT_SHIFT),
+                    _mm_srai_epi16(v[i + 1], IDCT_OUT_SHIFT)), vinv);
+            _mm_storel_epi64((__m128i *)&out[i * stride], p);
+            _mm_storel_epi64((__m128i *)&out[(i + 1) * stride],
+                    _mm_srli_si128(p, 8));
+        }
+    }
+}
+
+/*****************************************************************************/
+
+/* Idct_AVX2()
+ *
+ * AVX2 kernel of Idct_8x8(), two adjacent blocks at a time
+ */
+static void Idct_AVX2(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        int n,
+        int size,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) {
+    const __m256i k1414 = _mm256_set1_epi16(FIX_1_414213562);
+    const __m256i k1847 = _mm256_set1_epi16(FIX_1_847759065);
+    const __m256i k1082 = _mm256_set1_epi16(FIX_1_082392200);
+    const __m256i k0613 = _mm256_set1_epi16(FIX_0_613125930);
+    const __m256i bias  = _mm256_set1_epi16(
+            (128 << IDCT_OUT_SHIFT) + (1 << (IDCT_OUT_SHIFT - 1)));
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i vinv  = _mm256_set1_epi8((char)inv);
+    __m256i v[8], vdqs[8], p;
+    int b, i;
+
+    for (i = 0; i < size; i++)
+        vdqs[i] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i *)&dqs[i * 8]));
+
+    for (b = 0; b + 1 < n; b += 2, out += 16) {
+        for (i = 0; i < 8; i++)
+            v[i] = i < size ? _mm256_mullo_epi16(_mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_loadu_si128(
+                            (const __m128i *)&coef[b][i * 8])),
+                    _mm_loadu_si128((const __m128i *)&coef[b + 1][i * 8]), 1),
+                    vdqs[i]) : zero;
+
+        IDCT_AAN_SIZED_SIMD(__m256i, _mm256);
+        IDCT_TRANSPOSE_SIMD(__m256i, _mm256);
+
+        v[0] = _mm256_add_epi16(v[0], bias);
+        IDCT_AAN_SIZED_SIMD(__m256i, _mm256);
+        IDCT_TRANSPOSE_SIMD(__m256i, _mm256);
+
+        /* Packing leaves rows i and i + 1 of each block in its own lane,
+         * reorder them into two 16 pixel rows across both blocks */
+        for (i = 0; i < 8; i += 2) {
+            p = _mm256_permute4x64_epi64(_mm256_packus_epi16(
+                        _mm256_srai_epi16(v[i], IDCT_OUT_SHIFT),
+                        _mm256_srai_epi16(v[i + 1], IDCT_OUT_SHIFT)), 0xD8);
+            p = _mm256_xor_si256(p, vinv);
+            _mm_storeu_si128((__m128i *)&out[i * stride],
+                    _mm256_castsi256_si128(p));
+            _mm_storeu_si128((__m128i *)&out[(i + 1) * stride],
+                    _mm256_extracti128_si256(p, 1));
+        }
+    }
+
+    if (b < n)
+        Idct_SSE2(&coef[b], dqs, 1, size, out, stride, inv);
+}
+
+/*****************************************************************************/
+
+/* Idct_Check()
+ *
+ * Compares a SIMD kernel on each block size against the full
+ * Idct_Scalar() on pseudo-random blocks and dequantisation
+ * tables, wrapping 16 bit products and sums included.
+ * Returns true if they match bit for bit
+ */
+static bool Idct_Check(void (*idct)(
+            const int16_t (*coef)[64],
+            const int16_t *dqs,
+            int n,
+            int size,
+            uint8_t *out,
+            int stride,
+            uint8_t inv)) {
+    int16_t coef[IDCT_CHECK_BLOCKS][64], dqs[64];
+    uint8_t ref[8][IDCT_CHECK_BLOCKS * 8], res[8][IDCT_CHECK_BLOCKS * 8];
+    uint32_t seed = 1;
+    uint8_t inv;
+    int size, r, b, i;
+    bool dense;
+
+    for (size = 2; size <= 8; size *= 2)
+        for (r = 0; r < IDCT_CHECK_ROUNDS; r++) {
+            /* Sparse blocks of small coefficients, then dense wide ones */
+            dense = r >= IDCT_CHECK_ROUNDS / 2;
+
+            for (i = 0; i < 64; i++) {
+                seed = seed * 1103515245u + 12345u;
+                dqs[i] = dense ? (int16_t)(seed >> 16) :
+                    (int16_t)(1 + ((seed >> 16) & 0x7F));
+            }
+
+            for (b = 0; b < IDCT_CHECK_BLOCKS; b++)
+                for (i = 0; i < 64; i++) {
+                    seed = seed * 1103515245u + 12345u;
+                    if ((i / 8 >= size) || (i % 8 >= size))
+                        coef[b][i] = 0;
+                    else if (!dense)
+                        coef[b][i] = (seed >> 28) < (uint32_t)(16 - i / 4) ?
+                            (int16_t)((int32_t)((seed >> 4) & 0x7F) - 64) : 0;
+                    else
+                        coef[b][i] = (int16_t)(seed >> 16);
+                }
+
+            inv = (r & 1) ? 0xFF : 0;
+            Idct_Scalar((const int16_t (*)[64])coef, dqs, IDCT_CHECK_BLOCKS,
+                    8, &ref[0][0], IDCT_CHECK_BLOCKS * 8, inv);
+            idct((const int16_t (*)[64])coef, dqs, IDCT_CHECK_BLOCKS,
+                    size, &res[0][0], IDCT_CHECK_BLOCKS * 8, inv);
+
+            if (memcmp(ref, res, sizeof(ref)) != 0)
+                return false;
+        }
+
+    return true;
+}
+
+#endif
+
+/*****************************************************************************/
+
+/* Idct_Accuracy()
+ *
+ * Compares Idct_Scalar() against Flt_Idct_8x8() on pseudo-random
+ * blocks, quantised with pseudo-random tables as sent, and reports
+ * the largest pixel error and the share of pixels that match
+ */
+static void Idct_Accuracy(void) {
+    int16_t coef[64], dqs[64];
+    int dqt[64], quant[64];
+    double deq[64], ref[64];
+    uint8_t res[64];
+    uint32_t seed = 1, exact = 0;
+    int b, i, f, v, err, max_err = 0;
+    char mesg[MESG_SIZE];
+
+    for (b = 0; b < IDCT_ACCURACY_BLOCKS; b++) {
+        /* Steps growing with frequency f, and coefficients mostly
+         * zero or small past DC, as the FDCT of images gives */
+        for (i = 0; i < 64; i++) {
+            f = i / 8 + i % 8;
+
+            seed = seed * 1103515245u + 12345u;
+            dqt[i] = 2 + (int)((seed >> 16) % (uint32_t)(8 + 2 * f));
+
+            seed = seed * 1103515245u + 12345u;
+            if (i == 0)
+                quant[i] = (int)((seed >> 16) % 2048u) / dqt[i] - 1024 / dqt[i];
+            else if ((seed >> 28) < (uint32_t)(12 - f))
+                quant[i] = (int)((seed >> 16) % (uint32_t)(1 + 64 / (1 + f))) -
+                    32 / (1 + f);
+            else
+                quant[i] = 0;
+        }
+
+        Idct_Scale_Dqt(dqs, dqt);
+        for (i = 0; i < 64; i++) {
+            coef[i] = (int16_t)quant[i];
+            deq[i] = (double)(quant[i] * dqt[i]);
+        }
+
+        Idct_Scalar((const int16_t (*)[64])coef, dqs, 1, 8, res, 8, 0);
+        Flt_Idct_8x8(ref, deq);
+
+        for (i = 0; i < 64; i++) {
+            v = (int)lround(ref[i]) + 128;
+            v = v < 0 ? 0 : (v > 255 ? 255 : v);
+            err = abs(v - res[i]);
+
+            if (err == 0)
+                exact++;
+            if (err > max_err)
+                max_err = err;
+        }
+    }
+
+    snprintf(mesg, MESG_SIZE,
+            "IDCT accuracy: max error %d, %.1f%% of pixels exact",
+            max_err, 100.0 * exact / (IDCT_ACCURACY_BLOCKS * 64));
+    Print_Message(mesg,
+            (max_err > IDCT_ACCURACY_ERROR) ? ERROR_MESG : INFO_MESG);
+}
+
+/*****************************************************************************/
+
+/* Idct_Init()
+ *
+ * Selects the fastest IDCT kernel the CPU supports that passes
+ * a check against the scalar reference, the first time round,
+ * after checking the scalar one against the float IDCT
+ */
+void Idct_Init(void) {
+    static bool idct_checked = false;
+
+    memset(path_cnt, 0, sizeof(path_cnt));
+    if (idct_checked)
+        return;
+    idct_checked = true;
+
+    Idct_Accuracy();
+
+    Idct = Idct_Scalar;
+
+#ifdef IDCT_HAVE_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && Idct_Check(Idct_AVX2))
+        Idct = Idct_AVX2;
+    else if (__builtin_cpu_supports("sse2") && Idct_Check(Idct_SSE2))
+        Idct = Idct_SSE2;
+
+    if ((__builtin_cpu_supports("sse2") && (Idct == Idct_Scalar)) ||
+            (__builtin_cpu_supports("avx2") && (Idct != Idct_AVX2)))
+        Print_Message("SIMD IDCT failed its self-check", ERROR_MESG);
+#endif
+}
+
+/*****************************************************************************/
+
+/* Idct_Path()
+ *
+ * Returns the IDCT path of a block from the zig-zag
+ * index of its last non-zero coefficient
+ */
+static inline int Idct_Path(uint8_t last) {
+    if (last == 0)
+        return IDCT_PATH_DC;
+    if (last <= IDCT_LAST_2X2)
+        return IDCT_PATH_2X2;
+    if (last <= IDCT_LAST_4X4)
+        return IDCT_PATH_4X4;
+
+    return IDCT_PATH_FULL;
+}
+
+/*****************************************************************************/
+
+/* Idct_8x8()
+ *
+ * Transforms the quantised natural order coefficients of n
+ * horizontally adjacent blocks, dequantising them with the table
+ * dqs from Idct_Scale_Dqt() as they are loaded, and stores the level shifted and clamped pixels, XORed with inv,
+ * in rows of stride bytes at out. last holds the zig-zag index of the
+ * last non-zero coefficient of each block, runs of blocks as
+ * sparse as each other go through the matching shortcut
+ */
+void Idct_8x8(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        const uint8_t *last,
+        int n,
+        uint8_t *out,
+        int stride,
+        uint8_t inv) {
+    static const int path_size[IDCT_PATHS] = { 1, 2, 4, 8 };
+    int b, e, path;
+
+    for (b = 0; b < n; b = e) {
+        path = Idct_Path(last[b]);
+        for (e = b + 1; (e < n) && (Idct_Path(last[e]) == path); e++);
+
+        __atomic_fetch_add(&path_cnt[path], (uint32_t)(e - b),
+                __ATOMIC_RELAXED);
+
+        if (path == IDCT_PATH_DC)
+            Idct_DC(&coef[b], dqs, e - b, &out[b * 8], stride, inv);
+        else
+            Idct(&coef[b], dqs, e - b, path_size[path],
+                    &out[b * 8], stride, inv);
+    }
+}
+
+/*****************************************************************************/
+
+/* Idct_Path_Counts()
+ *
+ * Copies the number of blocks that took each IDCT path to cnt
+ */
+void Idct_Path_Counts(uint32_t *cnt) {
+    int i;
+
+    for (i = 0; i < IDCT_PATHS; i++)
+        cnt[i] = __atomic_load_n(&path_cnt[i], __ATOMIC_RELAXED);
+}
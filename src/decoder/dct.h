@@ -19,7 +19,32 @@
 
 /*****************************************************************************/
 
-void Flt_Idct_8x8(double *res, const double *inpt);
+#include <stdint.h>
+
+/*****************************************************************************/
+
+/* IDCT paths, by how far a block's non-zero coefficients reach */
+enum {
+    IDCT_PATH_DC = 0,
+    IDCT_PATH_2X2,
+    IDCT_PATH_4X4,
+    IDCT_PATH_FULL,
+    IDCT_PATHS
+};
+
+/*****************************************************************************/
+
+void Idct_Scale_Dqt(int16_t *dqs, const int *dqt);
+void Idct_Init(void);
+void Idct_8x8(
+        const int16_t (*coef)[64],
+        const int16_t *dqs,
+        const uint8_t *last,
+        int n,
+        uint8_t *out,
+        int stride,
+        uint8_t inv);
+void Idct_Path_Counts(uint32_t *cnt);
 
 /*****************************************************************************/
 
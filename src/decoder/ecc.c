@@ -21,6 +21,62 @@
 #include <string.h>
 #include <strings.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ECC_HAVE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/*****************************************************************************/
+
+#define RS_ROOTS    32      // Number of syndromes (parity symbols)
+#define RS_FCR      112     // First consecutive root
+#define RS_PRIM     11      // Primitive element used for the roots
+#define RS_LANES    16      // Byte lanes of an SSE register
+#define RS_BLOCKS   (ECC_CW_LEN / RS_LANES) // Padded codeword in lane blocks
+
+/*****************************************************************************/
+
+static void Syndromes_Scalar(
+        const uint8_t (*data)[ECC_CW_LEN],
+        int n,
+        uint8_t (*s)[RS_ROOTS]);
+#ifdef ECC_HAVE_SSSE3
+static void Syndromes_SSSE3(
+        const uint8_t (*data)[ECC_CW_LEN],
+        int n,
+        uint8_t (*s)[RS_ROOTS]) __attribute__((target("ssse3")));
+#endif
+static void Gather_Scalar(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out);
+#ifdef ECC_HAVE_SSSE3
+static void Gather_SSSE3(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out) __attribute__((target("ssse3")));
+#endif
+static int Chien_Scalar(
+        const uint8_t *lambda,
+        int deg_lambda,
+        uint8_t *root,
+        uint8_t *loc);
+#ifdef ECC_HAVE_SSSE3
+static int Chien_SSSE3(
+        const uint8_t *lambda,
+        int deg_lambda,
+        uint8_t *root,
+        uint8_t *loc) __attribute__((target("ssse3")));
+#endif
+static bool Ecc_Correct(
+        uint8_t *data,
+        int pad,
+        uint8_t *s,
+        uint8_t *ileave,
+        int depth);
+
 /*****************************************************************************/
 
 static const uint8_t alpha[256] = {
@@ -95,23 +151,420 @@ static const uint8_t indx[256] = {
 
 /*****************************************************************************/
 
-bool Ecc_Decode(uint8_t *idata, int pad) {
-  int i, j, r, k, deg_lambda, el, deg_omega;
+/* alpha[] repeated, so that the sum of two logs needs no modulo */
+static uint8_t alpha2[2 * 255];
+
+/* Log of the syndrome roots beta_i = alpha^((RS_FCR + i) * RS_PRIM) */
+static uint8_t root_log[RS_ROOTS];
+
+/* Split nibble tables for multiplying by beta_i^RS_LANES,
+ * (lo) for the low and (hi) for the high nibble */
+static uint8_t root16_lo[RS_ROOTS][16], root16_hi[RS_ROOTS][16];
+
+/* Log of beta_i^(RS_LANES - 1 - r), folds the lanes of a syndrome */
+static uint8_t fold_log[RS_ROOTS][RS_LANES];
+
+/* Codeword position of the i'th Chien search step */
+static uint8_t chien_loc[256];
+
+/* Split nibble tables for stepping term j of the error
+ * locator 16 positions ahead, i.e. multiplying by alpha^(16j) */
+static uint8_t chien16_lo[RS_ROOTS + 1][16], chien16_hi[RS_ROOTS + 1][16];
+
+/* Forney numerator factor X^(1 - RS_FCR), indexed by log X */
+static uint8_t forney_num2[256];
+
+/* Syndrome kernel, selected in Ecc_Init() */
+static void (*Syndromes)(
+        const uint8_t (*data)[ECC_CW_LEN],
+        int n,
+        uint8_t (*s)[RS_ROOTS]) = Syndromes_Scalar;
+
+/* Derandomise and de-interleave kernel, selected in Ecc_Init() */
+static void (*Gather)(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out) = Gather_Scalar;
+
+/* Error locator root search, selected in Ecc_Init() */
+static int (*Chien)(
+        const uint8_t *lambda,
+        int deg_lambda,
+        uint8_t *root,
+        uint8_t *loc) = Chien_Scalar;
+
+/*****************************************************************************/
+
+/* Ecc_Init()
+ *
+ * Builds the modulo-free GF(2^8) tables used by the decoder
+ * and selects the fastest syndrome kernel for this CPU
+ */
+void Ecc_Init(void) {
+  int i, r, root16;
+
+  for( i = 0; i < 2 * 255; i++ )
+    alpha2[i] = alpha[i % 255];
+
+  for( i = 0; i < RS_ROOTS; i++ )
+  {
+    root_log[i] = (uint8_t)( ((RS_FCR + i) * RS_PRIM) % 255 );
+    root16 = (root_log[i] * RS_LANES) % 255;
+
+    root16_lo[i][0] = 0;
+    root16_hi[i][0] = 0;
+    for( r = 1; r < 16; r++ )
+    {
+      root16_lo[i][r] = alpha2[indx[r] + root16];
+      root16_hi[i][r] = alpha2[indx[r << 4] + root16];
+    }
+
+    for( r = 0; r < RS_LANES; r++ )
+      fold_log[i][r] = (uint8_t)( (root_log[i] * (RS_LANES - 1 - r)) % 255 );
+  }
+
+  for( i = 0; i < 256; i++ )
+  {
+    chien_loc[i]   = (uint8_t)( (116 * i + 254) % 255 );
+    forney_num2[i] = alpha[ (i * (RS_FCR - 1)) % 255 ];
+  }
+
+  for( i = 0; i <= RS_ROOTS; i++ )
+  {
+    root16 = (i * RS_LANES) % 255;
+    chien16_lo[i][0] = 0;
+    chien16_hi[i][0] = 0;
+    for( r = 1; r < 16; r++ )
+    {
+      chien16_lo[i][r] = alpha2[indx[r] + root16];
+      chien16_hi[i][r] = alpha2[indx[r << 4] + root16];
+    }
+  }
+
+  Syndromes = Syndromes_Scalar;
+  Gather    = Gather_Scalar;
+  Chien     = Chien_Scalar;
+#ifdef ECC_HAVE_SSSE3
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("ssse3") )
+  {
+    Syndromes = Syndromes_SSSE3;
+    Gather    = Gather_SSSE3;
+    Chien     = Chien_SSSE3;
+  }
+#endif
+}
+
+/*****************************************************************************/
+
+/* Syndromes_Scalar()
+ *
+ * Computes the RS_ROOTS syndromes of n codewords, each right
+ * aligned in its ECC_CW_LEN buffer behind zero padding
+ */
+static void Syndromes_Scalar(
+        const uint8_t (*data)[ECC_CW_LEN],
+        int n,
+        uint8_t (*s)[RS_ROOTS]) {
+  int i, j, k;
+
+  for( k = 0; k < n; k++ )
+  {
+    for( i = 0; i < RS_ROOTS; i++ )
+      s[k][i] = 0;
+
+    for( j = 0; j < ECC_CW_LEN; j++ )
+      for( i = 0; i < RS_ROOTS; i++ )
+        if( s[k][i] == 0 ) s[k][i] = data[k][j];
+        else s[k][i] = data[k][j] ^ alpha2[ indx[s[k][i]] + root_log[i] ];
+  }
+}
+
+/*****************************************************************************/
+
+#ifdef ECC_HAVE_SSSE3
+
+/* Syndromes_SSSE3()
+ *
+ * Same as Syndromes_Scalar(), but runs Horner's rule on 16 byte
+ * lanes at once: every lane is multiplied by the same beta_i^16
+ * with two pshufb nibble lookups before the next block is added.
+ * Up to ECC_BATCH_MAX codewords share the lookup tables and run as
+ * independent chains. The 16 lanes of each are then folded into
+ * the syndrome with beta_i^(15 - r)
+ */
+static void Syndromes_SSSE3(
+        const uint8_t (*data)[ECC_CW_LEN],
+        int n,
+        uint8_t (*s)[RS_ROOTS]) {
+  int i, k, q, r;
+  uint8_t lanes[RS_LANES], x;
+  __m128i acc[ECC_BATCH_MAX], lo, hi, prod;
+  const __m128i mask = _mm_set1_epi8( 0x0F );
+
+  for( i = 0; i < RS_ROOTS; i++ )
+  {
+    lo = _mm_loadu_si128( (const __m128i *)root16_lo[i] );
+    hi = _mm_loadu_si128( (const __m128i *)root16_hi[i] );
+
+    for( k = 0; k < n; k++ )
+      acc[k] = _mm_setzero_si128();
+
+    for( q = 0; q < RS_BLOCKS; q++ )
+      for( k = 0; k < n; k++ )
+      {
+        prod = _mm_xor_si128(
+            _mm_shuffle_epi8(lo, _mm_and_si128(acc[k], mask)),
+            _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(acc[k], 4), mask)) );
+        acc[k] = _mm_xor_si128( prod,
+            _mm_loadu_si128((const __m128i *)&data[k][RS_LANES * q]) );
+      }
+
+    for( k = 0; k < n; k++ )
+    {
+      _mm_storeu_si128( (__m128i *)lanes, acc[k] );
+      x = 0;
+      for( r = 0; r < RS_LANES; r++ )
+        if( lanes[r] != 0 )
+          x ^= alpha2[ indx[lanes[r]] + fold_log[i][r] ];
+      s[k][i] = x;
+    }
+  }
+}
+
+#endif
+
+/*****************************************************************************/
+
+/* Gather_Scalar()
+ *
+ * XORs an ECC_FRAME_LEN long interleaved frame (data) with the
+ * PN sequence (pn), stores the result in out and splits it up
+ * into ECC_DEPTH codewords laid out as for Ecc_Decode_Batch()
+ */
+static void Gather_Scalar(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out) {
+  int i, k;
+  uint8_t x;
+
+  for( k = 0; k < ECC_DEPTH; k++ )
+    cw[k][0] = 0;
+
+  for( i = 0; i < 255; i++ )
+    for( k = 0; k < ECC_DEPTH; k++ )
+    {
+      x = data[ECC_DEPTH * i + k] ^ pn[ECC_DEPTH * i + k];
+      out[ECC_DEPTH * i + k] = x;
+      cw[k][i + 1] = x;
+    }
+}
+
+/*****************************************************************************/
+
+#ifdef ECC_HAVE_SSSE3
+
+/* Gather_SSSE3()
+ *
+ * Same as Gather_Scalar(), 16 symbols of each codeword at a time:
+ * pshufb groups the bytes of every codeword into 32 bit lanes and
+ * a 4x4 transpose of the lanes then gives a block per codeword
+ */
+static void Gather_SSSE3(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out) {
+  int i, k, r;
+  uint8_t x;
+  __m128i v[ECC_DEPTH], t0, t1, t2, t3;
+  const __m128i split = _mm_setr_epi8(
+      0, 4,  8, 12, 1, 5,  9, 13,
+      2, 6, 10, 14, 3, 7, 11, 15 );
+
+  for( k = 0; k < ECC_DEPTH; k++ )
+    cw[k][0] = 0;
+
+  for( i = 0; i + 16 <= 255; i += 16 )
+  {
+    for( r = 0; r < ECC_DEPTH; r++ )
+    {
+      v[r] = _mm_xor_si128(
+          _mm_loadu_si128((const __m128i *)&data[ECC_DEPTH * i + 16 * r]),
+          _mm_loadu_si128((const __m128i *)&pn[ECC_DEPTH * i + 16 * r]) );
+      _mm_storeu_si128( (__m128i *)&out[ECC_DEPTH * i + 16 * r], v[r] );
+      v[r] = _mm_shuffle_epi8( v[r], split );
+    }
+
+    t0 = _mm_unpacklo_epi32( v[0], v[1] );
+    t1 = _mm_unpacklo_epi32( v[2], v[3] );
+    t2 = _mm_unpackhi_epi32( v[0], v[1] );
+    t3 = _mm_unpackhi_epi32( v[2], v[3] );
+    _mm_storeu_si128( (__m128i *)&cw[0][i + 1], _mm_unpacklo_epi64(t0, t1) );
+    _mm_storeu_si128( (__m128i *)&cw[1][i + 1], _mm_unpackhi_epi64(t0, t1) );
+    _mm_storeu_si128( (__m128i *)&cw[2][i + 1], _mm_unpacklo_epi64(t2, t3) );
+    _mm_storeu_si128( (__m128i *)&cw[3][i + 1], _mm_unpackhi_epi64(t2, t3) );
+  }
+
+  for( ; i < 255; i++ )
+    for( k = 0; k < ECC_DEPTH; k++ )
+    {
+      x = data[ECC_DEPTH * i + k] ^ pn[ECC_DEPTH * i + k];
+      out[ECC_DEPTH * i + k] = x;
+      cw[k][i + 1] = x;
+    }
+}
+
+#endif
+
+/*****************************************************************************/
+
+/* Chien_Scalar()
+ *
+ * Finds the roots of the error locator lambda (log form, degree
+ * deg_lambda) over the 255 codeword positions. Stores the root
+ * exponents in root and their codeword positions in loc, stopping
+ * as soon as deg_lambda roots are found. Returns the roots found
+ */
+static int Chien_Scalar(
+        const uint8_t *lambda,
+        int deg_lambda,
+        uint8_t *root,
+        uint8_t *loc) {
+  int i, j, cnt;
+  int reg[RS_ROOTS + 1];
+  uint8_t q;
+
+  for( j = 1; j <= deg_lambda; j++ )
+    reg[j] = lambda[j];
+
+  cnt = 0;
+  for( i = 1; (i <= 255) && (cnt < deg_lambda); i++ )
+  {
+    q = 1;
+    for( j = deg_lambda; j >= 1; j-- )
+    {
+      if( reg[j] != 255 )
+      {
+        reg[j] += j;
+        if( reg[j] >= 255 ) reg[j] -= 255;
+        q ^= alpha[ reg[j] ];
+      }
+    }
+
+    if( q == 0 )
+    {
+      root[cnt] = (uint8_t)i;
+      loc[cnt]  = chien_loc[i];
+      cnt++;
+    }
+  }
+
+  return( cnt );
+}
+
+/*****************************************************************************/
+
+#ifdef ECC_HAVE_SSSE3
+
+/* Chien_SSSE3()
+ *
+ * Same as Chien_Scalar(), but evaluates the error locator at 16
+ * positions at once: the lanes of term j hold lambda_j * X^j for
+ * 16 consecutive positions X and are stepped to the next 16 with
+ * a pshufb multiply by alpha^(16j)
+ */
+static int Chien_SSSE3(
+        const uint8_t *lambda,
+        int deg_lambda,
+        uint8_t *root,
+        uint8_t *loc) {
+  int i, j, n, e, cnt, blk, mask;
+  int term[RS_ROOTS + 1];
+  uint8_t lanes[RS_LANES];
+  __m128i acc[RS_ROOTS + 1], sum, lo, hi;
+  const __m128i one = _mm_set1_epi8( 1 );
+  const __m128i nib = _mm_set1_epi8( 0x0F );
+
+  //Only the nonzero terms of lambda take part
+  n = 0;
+  for( j = 1; j <= deg_lambda; j++ )
+  {
+    if( lambda[j] == 255 ) continue;
+
+    e = j;
+    for( i = 0; i < RS_LANES; i++ )
+    {
+      lanes[i] = alpha2[ lambda[j] + e ];
+      e += j;
+      if( e >= 255 ) e -= 255;
+    }
+    acc[n]  = _mm_loadu_si128( (const __m128i *)lanes );
+    term[n] = j;
+    n++;
+  }
+
+  cnt = 0;
+  for( blk = 0; blk < 256 / RS_LANES; blk++ )
+  {
+    sum = _mm_setzero_si128();
+    for( j = 0; j < n; j++ )
+      sum = _mm_xor_si128( sum, acc[j] );
+
+    //lambda(X) = 1 ^ sum is zero where sum is one. The last
+    //lane of the last block would be position 256, ie 1 again
+    mask = _mm_movemask_epi8( _mm_cmpeq_epi8(sum, one) );
+    if( blk == 256 / RS_LANES - 1 ) mask &= 0x7FFF;
+
+    while( mask != 0 )
+    {
+      i = RS_LANES * blk + 1 + __builtin_ctz( (unsigned)mask );
+      root[cnt] = (uint8_t)i;
+      loc[cnt]  = chien_loc[i];
+      if( ++cnt == deg_lambda ) return( cnt );
+      mask &= mask - 1;
+    }
+
+    for( j = 0; j < n; j++ )
+    {
+      lo = _mm_loadu_si128( (const __m128i *)chien16_lo[term[j]] );
+      hi = _mm_loadu_si128( (const __m128i *)chien16_hi[term[j]] );
+      acc[j] = _mm_xor_si128(
+          _mm_shuffle_epi8(lo, _mm_and_si128(acc[j], nib)),
+          _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(acc[j], 4), nib)) );
+    }
+  }
+
+  return( cnt );
+}
+
+#endif
+
+/*****************************************************************************/
+
+/* Ecc_Correct()
+ *
+ * Corrects the codeword in data from its syndromes s (polynomial
+ * form, overwritten). Corrections are also applied to the byte
+ * interleaved copy in ileave (every depth'th byte), if not NULL.
+ * Returns false if the codeword is not correctable
+ */
+static bool Ecc_Correct(
+        uint8_t *data,
+        int pad,
+        uint8_t *s,
+        uint8_t *ileave,
+        int depth) {
+  int i, j, r, e, deg_lambda, el, deg_omega;
   int syn_error;
-  uint8_t q, tmp, num1, num2, den, discr_r;
-  uint8_t lambda[33], b[33], reg[33], t[33], omega[33];
-  uint8_t root[32], s[32], loc[32];
-  uint8_t *data;
+  uint8_t tmp, num1, num2, den, discr_r;
+  uint8_t lambda[33], b[33], t[33], omega[33];
+  uint8_t root[32], loc[32];
   int result = 0; /* holds amount of errors fixed */
 
-  data = idata;
-  for( i = 0; i < 32; i++ )
-    s[i] = data[0];
-  for( j = 1; j < 255 - pad; j++ )
-    for( i = 0; i < 32; i++ )
-      if( s[i] == 0 ) s[i] = data[j];
-      else s[i] = data[j] ^ alpha[ (indx[s[i]] + (112 + i) * 11) % 255 ];
-
   syn_error = 0;
   for( i = 0; i < 32; i++ )
   {
@@ -135,7 +588,7 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
     discr_r = 0;
     for( i = 0; i < r; i++ )
       if( (lambda[i] != 0) && (s[r - i - 1] != 255) )
-        discr_r ^= alpha[ (indx[lambda[i]] + s[r - i - 1]) % 255 ];
+        discr_r ^= alpha2[ indx[lambda[i]] + s[r - i - 1] ];
 
     discr_r = indx[discr_r];
     if( discr_r == 255 )
@@ -149,7 +602,7 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
       for( i = 0; i < 32; i++ )
       {
         if( b[i] != 255 )
-          t[i + 1] = lambda[i + 1] ^ alpha[ (discr_r + b[i]) % 255 ];
+          t[i + 1] = lambda[i + 1] ^ alpha2[ discr_r + b[i] ];
         else
           t[i + 1] = lambda[i + 1];
       }
@@ -160,7 +613,11 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
         for( i = 0; i < 32; i++ )
         {
           if( lambda[i] == 0 ) b[i] = 255;
-          else b[i] = (uint8_t)( (indx[lambda[i]] - discr_r + 255) % 255 );
+          else
+          {
+            e = indx[lambda[i]] + 255 - discr_r;
+            b[i] = (uint8_t)( (e >= 255) ? e - 255 : e );
+          }
         }
       }
       else
@@ -180,42 +637,7 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
     if( lambda[i] != 255 ) deg_lambda = i;
   }
 
-  memmove( &reg[1], &lambda[1], 32 );
-  result = 0;
-
-  i = 1;
-  k = 115;
-
-  while (true) {
-    if( !(i <= 255) ) break;
-
-    q = 1;
-    for( j = deg_lambda; j >= 1; j-- )
-    {
-      if( reg[j] != 255 )
-      {
-        reg[j] = (uint8_t)( (reg[j] + j) % 255 );
-        q ^= alpha[ reg[j] ];
-      }
-    }
-
-    if( q != 0 )
-    {
-      i++;
-      k = (k + 116) % 255;
-      continue;
-    }
-
-    root[result] = (uint8_t)i;
-    loc[result]  = (uint8_t)k;
-    result++;
-    if( result == deg_lambda )
-      break;
-
-    i++;
-    k = (k + 116) % 255;
-  }
-
+  result = Chien( lambda, deg_lambda, root, loc );
   if (deg_lambda != result)
       return false;
 
@@ -225,32 +647,47 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
     tmp = 0;
     for( j = i; j >= 0; j-- )
       if( (s[i - j] != 255) && (lambda[j] != 255) )
-        tmp ^= alpha[ (s[i - j] + lambda[j]) % 255 ];
+        tmp ^= alpha2[ s[i - j] + lambda[j] ];
     omega[i] = indx[tmp];
   }
 
+  //Powers of the roots are stepped along instead of
+  //multiplied out, which keeps all logs below 2 * 255
   for( j = result - 1; j >= 0; j-- )
   {
     num1 = 0;
-    for( i = deg_omega; i >= 0; i-- )
+    e = 0;
+    for( i = 0; i <= deg_omega; i++ )
+    {
       if( omega[i] != 255 )
-        num1 ^= alpha[ (omega[i] + i * root[j]) % 255 ];
-    num2 = alpha[ (root[j] * 111 + 255) % 255 ];
-    den = 0;
+        num1 ^= alpha2[ omega[i] + e ];
+      e += root[j];
+      if( e >= 255 ) e -= 255;
+    }
 
-    if( deg_lambda < 31 ) i = deg_lambda;
-    else i = 31;
-    i &= ~1;
+    if( (num1 == 0) || (loc[j] < pad) )
+      continue;
 
-    while (true) {
-      if( !(i >= 0) ) break;
+    num2 = forney_num2[ root[j] ];
+    den = 0;
+    e = 0;
+    r = 2 * root[j];
+    if( r >= 255 ) r -= 255;
+    for( i = 0; (i <= deg_lambda) && (i <= 31); i += 2 )
+    {
       if( lambda[i + 1] != 255 )
-        den ^= alpha[ (lambda[i + 1] + i * root[j]) % 255 ];
-      i -= 2;
+        den ^= alpha2[ lambda[i + 1] + e ];
+      e += r;
+      if( e >= 255 ) e -= 255;
     }
 
-    if( (num1 != 0) && (loc[j] >= pad) )
-      data[loc[j] - pad] ^= alpha[ (indx[num1] + indx[num2] + 255 - indx[den]) % 255 ];
+    e = indx[num1] + indx[num2];
+    if( e >= 255 ) e -= 255;
+    tmp = alpha2[ e + 255 - indx[den] ];
+
+    data[loc[j] - pad] ^= tmp;
+    if( ileave != NULL )
+      ileave[(loc[j] - pad) * depth] ^= tmp;
   }
 
   return true;
@@ -258,16 +695,48 @@ bool Ecc_Decode(uint8_t *idata, int pad) {
 
 /*****************************************************************************/
 
-void Ecc_Deinterleave(uint8_t *data, uint8_t *output, int pos, int n) {
-  int i;
-  for( i = 0; i < 255; i++ )
-    output[i] = data[ i * n + pos ];
+/* Ecc_Decode_Batch()
+ *
+ * Decodes n codewords at once, each right aligned in its ECC_CW_LEN
+ * buffer behind a zero byte, and sets ok[] for each. Syndromes of up
+ * to ECC_BATCH_MAX codewords are computed together; the few that need
+ * correcting are then fixed one after the other, which at a few
+ * microseconds each is far cheaper than handing them to other threads.
+ * If ileave is not NULL, it holds the n codewords byte interleaved
+ * and only the corrected bytes are written back to it
+ */
+void Ecc_Decode_Batch(
+        uint8_t (*cw)[ECC_CW_LEN],
+        int n,
+        bool *ok,
+        uint8_t *ileave) {
+  int k, m;
+  uint8_t s[ECC_BATCH_MAX][RS_ROOTS];
+
+  for( k = 0; k < n; k += ECC_BATCH_MAX )
+  {
+    m = n - k;
+    if( m > ECC_BATCH_MAX ) m = ECC_BATCH_MAX;
+
+    Syndromes( (const uint8_t (*)[ECC_CW_LEN])&cw[k], m, s );
+    for( m--; m >= 0; m-- )
+      ok[k + m] = Ecc_Correct( &cw[k + m][1], 0, s[m],
+          (ileave != NULL) ? &ileave[k + m] : NULL, n );
+  }
 }
 
 /*****************************************************************************/
 
-void Ecc_Interleave(uint8_t *data, uint8_t *output, int pos, int n) {
-  int i;
-  for( i = 0; i < 255; i++ )
-    output[ i * n + pos] = data[i];
+/* Ecc_Gather()
+ *
+ * Derandomises an interleaved frame of ECC_DEPTH codewords with the
+ * pre-expanded PN sequence pn in a single pass, keeping the result in
+ * out and de-interleaving it into cw for Ecc_Decode_Batch()
+ */
+void Ecc_Gather(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out) {
+  Gather( data, pn, cw, out );
 }
@@ -24,9 +24,28 @@
 
 /*****************************************************************************/
 
-bool Ecc_Decode(uint8_t *idata, int pad);
-void Ecc_Deinterleave(uint8_t *data, uint8_t *output, int pos, int n);
-void Ecc_Interleave(uint8_t *data, uint8_t *output, int pos, int n);
+/* Codeword buffer length for the batch decoder, codewords are
+ * right aligned behind a zero byte (which leaves syndromes as is) */
+#define ECC_CW_LEN      256
+#define ECC_BATCH_MAX   4
+
+/* Interleave depth of a frame and its length in bytes */
+#define ECC_DEPTH       4
+#define ECC_FRAME_LEN   (ECC_DEPTH * 255)
+
+/*****************************************************************************/
+
+void Ecc_Init(void);
+void Ecc_Decode_Batch(
+        uint8_t (*cw)[ECC_CW_LEN],
+        int n,
+        bool *ok,
+        uint8_t *ileave);
+void Ecc_Gather(
+        const uint8_t *data,
+        const uint8_t *pn,
+        uint8_t (*cw)[ECC_CW_LEN],
+        uint8_t *out);
 
 /*****************************************************************************/
 
@@ -17,23 +17,25 @@
 #include "huffman.h"
 
 #include "../common/shared.h"
-#include "../mlrpt/utils.h"
 
 #include <stdbool.h>
-#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 /*****************************************************************************/
 
-static int Get_AC_Real(const uint16_t w);
-static int Get_DC_Real(const uint16_t w);
+static void Build_Table(huff_table_t *t, const uint8_t *spec);
 
 /*****************************************************************************/
 
-static int ac_lookup[65536];
-static int dc_lookup[65536];
+/* Table specs: code counts of lengths 1-16, then the symbols */
+static const uint8_t t_dc_0[28] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0,
+    0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5,
+    6, 7, 8, 9, 10, 11
+};
 
-static uint8_t t_ac_0[178] = {
+static const uint8_t t_ac_0[178] = {
     0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4,
     4, 0, 0, 1, 125, 1, 2, 3, 0, 4, 17,
     5, 18, 33, 49, 65, 6, 19, 81, 97, 7, 34,
@@ -55,52 +57,67 @@ static uint8_t t_ac_0[178] = {
 
 /*****************************************************************************/
 
-int Get_AC(const uint16_t w) {
-  return( ac_lookup[w] );
-}
+/* Build_Table()
+ *
+ * Builds a decoder table from a spec of the canonical code
+ */
+static void Build_Table(huff_table_t *t, const uint8_t *spec) {
+  int k, i, j, idx, fill;
+  int32_t code;
+  const uint8_t *val = &spec[16];
 
-/*****************************************************************************/
+  memset( t, 0, sizeof(huff_table_t) );
 
-int Get_DC(const uint16_t w) {
-  return( dc_lookup[w] );
-}
+  code = 0;
+  idx  = 0;
+  for( k = 1; k <= 16; k++ )
+  {
+    t->val_off[k]  = idx - code;
+    t->max_code[k] = -1;
 
-/*****************************************************************************/
+    for( i = 0; i < spec[k - 1]; i++ )
+    {
+      t->val[idx] = val[idx];
+
+      //Every lookahead that starts with the code maps to it
+      if( k <= HUFF_LOOKAHEAD )
+      {
+        fill = 1 << (HUFF_LOOKAHEAD - k);
+        for( j = 0; j < fill; j++ )
+          t->fast[(code << (HUFF_LOOKAHEAD - k)) + j] =
+            (uint16_t)( (k << 8) | val[idx] );
+      }
 
-static int Get_AC_Real(const uint16_t w) {
-  int i;
+      t->max_code[k] = code;
+      code++;
+      idx++;
+    }
 
-  for( i = 0; (size_t)i < ac_table_len; i++ )
-  {
-    if( ((w >> (16 - ac_table[i].len)) &
-          ac_table[i].mask) == ac_table[i].code )
-      return( i );
+    code <<= 1;
   }
-
-  return( -1 );
 }
 
 /*****************************************************************************/
 
-static int Get_DC_Real(const uint16_t w) {
-  if( (w >> 14) == 0 ) return( 0 );
+/* Huff_Decode_Slow()
+ *
+ * Decodes a code longer than HUFF_LOOKAHEAD bits, returns -1 if invalid
+ */
+int Huff_Decode_Slow(bit_io_rec_t *b, const huff_table_t *t) {
+  int k;
+  int32_t code;
 
-  switch( w >> 13 )
+  for( k = HUFF_LOOKAHEAD + 1; k <= 16; k++ )
   {
-    case 2: return( 1 );
-    case 3: return( 2 );
-    case 4: return( 3 );
-    case 5: return( 4 );
-    case 6: return( 5 );
+    code = (int32_t)Bitop_PeekNBits( b, k );
+    if( code <= t->max_code[k] )
+    {
+      Bitop_AdvanceNBits( b, k );
+      return( t->val[code + t->val_off[k]] );
+    }
   }
 
-  if( (w  >>  12) == 0x00E ) return( 6 );
-  else if( (w  >>  11) == 0x01E )  return( 7 );
-  else if( (w  >>  10) == 0x03E )  return( 8 );
-  else if( (w  >>   9) == 0x07E )  return( 9 );
-  else if( (w  >>   8) == 0x0FE )  return( 10 );
-  else if( (w  >>   7) == 0x1FE )  return( 11 );
-  else return( -1 );
+  return( -1 );
 }
 
 /*****************************************************************************/
@@ -109,6 +126,8 @@ int Map_Range(const int cat, const int vl) {
   int maxval, result;
   bool sig;
 
+  if( cat == 0 ) return( 0 );
+
   maxval = (1 << cat) - 1;
   sig = (vl >> (cat - 1)) != 0;
 
@@ -123,74 +142,6 @@ int Map_Range(const int cat, const int vl) {
 /*****************************************************************************/
 
 void Default_Huffman_Table(void) {
-  int k, i, n;
-  uint32_t code;
-  uint8_t *t;
-  int p;
-  uint8_t v[65536];
-  uint16_t min_code[17], maj_code[17];
-  uint16_t max_val, min_val, size_val;
-  int min_valn, max_valn, run, size;
-
-  t = t_ac_0;
-  p = 16;
-  for( k = 1; k <= 16; k++ )
-    for( i = 0; i < t[k - 1]; i++ )
-    {
-      v[(k << 8) + i] = t[p];
-      p++;
-    }
-
-  code = 0;
-  for( k = 1; k <= 16; k++ )
-  {
-    min_code[k] = (uint16_t)code;
-    for( i = 1; i <= t[k - 1]; i++ )
-      code++;
-    maj_code[k] = (uint16_t)( code - 1 * (uint32_t)(code != 0) );
-    code *= 2;
-    if( t[k - 1] == 0 )
-    {
-      min_code[k] = 0xFFFF;
-      maj_code[k] = 0;
-    }
-  }
-
-  ac_table_len = 256;
-  mem_alloc( (void **)&ac_table, ac_table_len * sizeof(ac_table_rec_t)) ;
-
-  n = 0;
-  min_valn = 1;
-  max_valn = 1;
-  for( k = 1; k <= 16; k++ )
-  {
-    min_val = min_code[min_valn];
-    max_val = maj_code[max_valn];
-    for( i = 0; i < (1 << k); i++ )
-    {
-      if( ((uint32_t)i <= max_val) &&
-          ((uint32_t)i >= min_val) )
-      {
-        size_val = v[(k << 8) + i - (int)min_val];
-        run = size_val >> 4;
-        size = size_val & 0x0F;
-        ac_table[n].run  = run;
-        ac_table[n].size = size;
-        ac_table[n].len  = k;
-        ac_table[n].mask = (1 << k) - 1;
-        ac_table[n].code = (uint32_t)i;
-        n++;
-      }
-    }
-    min_valn++;
-    max_valn++;
-  }
-
-  ac_table_len = (size_t)n;
-  mem_realloc( (void **)&ac_table, ac_table_len * sizeof(ac_table_rec_t) );
-
-  for( i = 0; i <= 65535; i++ )
-    ac_lookup[i] = Get_AC_Real((uint16_t)i);
-  for( i = 0; i <= 65535; i++ )
-    dc_lookup[i] = Get_DC_Real((uint16_t)i);
+  Build_Table( &huff_dc, t_dc_0 );
+  Build_Table( &huff_ac, t_ac_0 );
 }
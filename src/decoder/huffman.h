@@ -19,23 +19,48 @@
 
 /*****************************************************************************/
 
+#include "bitop.h"
+
 #include <stdint.h>
 
 /*****************************************************************************/
 
-/* Decoder AC table data */
-typedef struct ac_table_rec_t {
-  int run, size, len;
-  uint32_t mask, code;
-} ac_table_rec_t;
+/* Codes up to this long are decoded with one table lookup */
+#define HUFF_LOOKAHEAD  10
+
+/* Decoder Huffman table. A fast entry, indexed by the next
+ * HUFF_LOOKAHEAD bits, packs the code length in bits 8-12 and
+ * the symbol in bits 0-7; it is 0 for longer or invalid codes.
+ * These are decoded canonically from max_code and val_off */
+typedef struct huff_table_t {
+  uint16_t fast[1 << HUFF_LOOKAHEAD];
+  int32_t max_code[17];
+  int val_off[17];
+  uint8_t val[256];
+} huff_table_t;
 
 /*****************************************************************************/
 
-int Get_AC(const uint16_t w);
-int Get_DC(const uint16_t w);
+int Huff_Decode_Slow(bit_io_rec_t *b, const huff_table_t *t);
 int Map_Range(const int cat, const int vl);
 void Default_Huffman_Table(void);
 
 /*****************************************************************************/
 
+/* Huff_Decode()
+ *
+ * Consumes a Huffman code and returns its symbol, or -1 if invalid
+ */
+static inline int Huff_Decode(bit_io_rec_t *b, const huff_table_t *t) {
+  uint16_t e = t->fast[Bitop_PeekNBits(b, HUFF_LOOKAHEAD)];
+
+  if( e == 0 )
+    return( Huff_Decode_Slow(b, t) );
+
+  Bitop_AdvanceNBits( b, e >> 8 );
+  return( e & 0xFF );
+}
+
+/*****************************************************************************/
+
 #endif
@@ -19,7 +19,10 @@
 #include "../common/common.h"
 #include "../common/shared.h"
 #include "../mlrpt/utils.h"
+#include "cadu_out.h"
 #include "correlator.h"
+#include "dct.h"
+#include "ecc.h"
 #include "met_jpg.h"
 #include "met_packet.h"
 #include "met_to_data.h"
@@ -42,8 +45,12 @@ void Medet_Init(void) {
 
   /* Initialize things */
   Init_Correlator_Tables();
+  Ecc_Init();
+  Idct_Init();
   Mj_Init();
+  Mp_Init();
   Mtd_Init( &mtd_record );
+  Cadu_Out_Open();
 
   /* Channel_image[idx] is free'd and set to NULL if
    * already allocated, otherwise it is only set to NULL */
@@ -64,7 +71,6 @@ void Medet_Init(void) {
  */
 void Medet_Deinit(void) {
   free_ptr( (void **)&(mtd_record.v.pair_distances) );
-  free_ptr( (void **)&ac_table );
   uint8_t **dec = ret_decoded();
   free_ptr( (void **)dec );
 }
@@ -81,6 +87,9 @@ void Decode_Image(uint8_t *in_buffer, int buf_len) {
   while( mtd_record.pos < buf_len )
   {
     ok = Mtd_One_Frame( &mtd_record, in_buffer );
+    if( mtd_record.frame_out )
+      Cadu_Out_Frame( &mtd_record, ok );
+
     if (ok) {
       Parse_Cvcdu( mtd_record.ecced_data, HARD_FRAME_LEN - 132 );
       ok_cnt++;
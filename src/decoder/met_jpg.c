@@ -20,6 +20,9 @@
 #include "../common/shared.h"
 #include "../mlrpt/clahe.h"
 #include "../mlrpt/image.h"
+#include "../mlrpt/image_store.h"
+#include "../mlrpt/jpeg_coefs.h"
+#include "../mlrpt/live_image.h"
 #include "../mlrpt/utils.h"
 #include "bitop.h"
 #include "dct.h"
@@ -27,20 +30,65 @@
 #include "rectify_meteor.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 /*****************************************************************************/
 
 #define MCU_PER_PACKET  14
 
+/* Packets waiting for the decoding threads */
+#define MCU_QUEUE_LEN   256
+
+/* Length of the ring counting the queued packets of each MCU row.
+ * Rows sharing a counter only hold each other back */
+#define ROW_JOBS_RING   1024
+
+/*****************************************************************************/
+
+/* An image packet to decode and where its MCUs go */
+typedef struct mcu_job_t {
+  uint8_t *data;
+  size_t size; //Allocated length of data
+  int len;
+  const int16_t *dqs;
+  const int16_t *dqt;
+  uint8_t *out;
+  int16_t *coefs; //Where to keep the coefficients, if at all
+  uint32_t row;   //MCU row of the image
+  uint8_t inv;
+} mcu_job_t;
+
 /*****************************************************************************/
 
 static void Save_Images(int type);
 static void Fill_Dqt_by_Q(int *dqt, int q);
-static void Fill_Pix(double *img_dct, uint32_t apid, int mcu_id, int m);
+static const int16_t *Get_Dqs(uint8_t q);
+static int Channel_Apid(uint32_t idx);
+static const image_store_t *Channel_Store(uint32_t idx);
+static bool Save_Channel_Coefs(const char *fname, uint32_t idx);
+static void Map_Channels(void);
+static bool Dec_Block(
+    bit_io_rec_t *b,
+    const int16_t *dqt,
+    int *prev_dc,
+    int16_t *coef,
+    int16_t *raw,
+    uint8_t *last);
+static void Dec_Packet(const mcu_job_t *job);
+static void *Mcu_Worker(void *arg);
+static void Start_Workers(void);
+static void Stop_Workers(void);
+static void Drain_Queue(void);
+static void Queue_Packet(const mcu_job_t *job);
+static void Grow_Image(int idx);
 static bool Progress_Image(uint32_t apid, int mcu_id, int pck_cnt);
+static void Publish_Rows(uint32_t rows, bool wait);
 
 /*****************************************************************************/
 
@@ -50,6 +98,43 @@ static int last_y    = -1;
 static int first_pck = 0;
 static int prev_pck  = 0;
 
+/* Image of every imaging APID received, all of channel_image_height */
+static image_store_t apid_image[APID_IMAGE_NUM];
+
+/* Dequantised DCT coefficients of the APID images, kept for lossless
+ * JPEG output, with the quality factors and inversion they came with */
+static image_store_t apid_coefs[APID_IMAGE_NUM];
+static bool apid_q[APID_IMAGE_NUM][256];
+static uint8_t apid_inv[APID_IMAGE_NUM];
+
+/* IDCT scaled dequantisation tables, in natural order, of
+ * every quality factor met so far. See Get_Dqs() */
+static int16_t dqs_cache[256][64];
+static bool dqs_cached[256];
+
+/* Plain dequantisation tables, in natural order, next to dqs_cache */
+static int16_t dqt_cache[256][64];
+
+/* Ring of packets queued for the worker threads. Workers take the
+ * packet at queue_head, swapping data buffers with its slot */
+static mcu_job_t mcu_queue[MCU_QUEUE_LEN];
+static int queue_head = 0;
+static int queue_cnt  = 0;  // Packets queued
+static int queue_busy = 0;  // Packets being decoded
+static bool queue_stop = false;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_freed  = PTHREAD_COND_INITIALIZER;
+
+static pthread_t mcu_thread[DECODE_THREADS_MAX];
+static int mcu_threads = 0;
+
+/* Packets of each MCU row queued or being decoded, by row
+ * modulo ROW_JOBS_RING, and rows handed to the live writer */
+static int row_jobs[ROW_JOBS_RING];
+static uint32_t live_rows = 0;
+
 static const uint8_t standard_quantization_table[64] = {
     16,  11,  10,  16,  24,  40,  51,  61,
     12,  12,  14,  19,  26,  58,  60,  55,
@@ -61,19 +146,18 @@ static const uint8_t standard_quantization_table[64] = {
     72,  92,  95,  98, 112, 100, 103,  99
 };
 
-static const uint8_t zigzag[64] = {
-    0,  1,  5,  6, 14, 15, 27, 28,
-    2,  4,  7, 13, 16, 26, 29, 42,
-    3,  8, 12, 17, 25, 30, 41, 43,
-    9, 11, 18, 24, 31, 40, 44, 53,
-    10, 19, 23, 32, 39, 45, 52, 54,
-    20, 22, 33, 38, 46, 51, 55, 60,
-    21, 34, 37, 47, 50, 56, 59, 61,
-    35, 36, 48, 49, 57, 58, 62, 63
+/* Natural order index of each zig-zag order coefficient */
+static const uint8_t natural_order[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
 };
 
-static const int dc_cat_off[12] = { 2, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9 };
-
 /*****************************************************************************/
 
 /* Save_Images()
@@ -89,8 +173,10 @@ static void Save_Images(int type) {
   {
     for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
     {
-      /* Save channel images as raw PGM */
-      if( isFlagSet(IMAGE_SAVE_PPGM) )
+      /* Save channel images as raw PGM, unless
+       * the raw one was written whole as it decoded */
+      if( isFlagSet(IMAGE_SAVE_PPGM) &&
+          ((type != IMAGE_RAW) || !Live_Saved(idx)) )
       {
         /* Save unprocessed image */
         fname[0] = '\0';
@@ -113,11 +199,15 @@ static void Save_Images(int type) {
           File_Name( fname, idx, "-raw.jpg" );
         else
           File_Name( fname, idx, ".jpg" );
-        Save_Image_JPEG(fname,
-            (int)channel_image_width,
-            (int)channel_image_height,
-            true,
-            channel_image[idx]);
+
+        /* Raw images can be written from the coefficients sent */
+        if( (type != IMAGE_RAW) || !isFlagSet(IMAGE_JPEG_LOSSLESS) ||
+            !Save_Channel_Coefs(fname, idx) )
+          Save_Image_JPEG(fname,
+              (int)channel_image_width,
+              (int)channel_image_height,
+              true,
+              channel_image[idx]);
       }
 
     } /* for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ ) */
@@ -167,13 +257,122 @@ static void Save_Images(int type) {
 
 /*****************************************************************************/
 
+/* Channel_Apid()
+ *
+ * Returns the index of the APID image of channel idx,
+ * or -1 if the APID isn't an imaging one
+ */
+static int Channel_Apid(uint32_t idx) {
+  if ((rc_data.apid[idx] >= APID_IMAGE_FIRST) &&
+      (rc_data.apid[idx] < APID_IMAGE_FIRST + APID_IMAGE_NUM))
+    return rc_data.apid[idx] - APID_IMAGE_FIRST;
+
+  return -1;
+}
+
+/*****************************************************************************/
+
+/* Channel_Store()
+ *
+ * Returns the image of the APID of channel idx, or
+ * NULL if the APID isn't an imaging one
+ */
+static const image_store_t *Channel_Store(uint32_t idx) {
+  int apid = Channel_Apid(idx);
+
+  return (apid < 0) ? NULL : &apid_image[apid];
+}
+
+/*****************************************************************************/
+
+/* Save_Channel_Coefs()
+ *
+ * Saves the raw image of channel idx as JPEG from the coefficients
+ * sent. Its quantisation table divides the tables of all quality
+ * factors used, so that the coefficients stay exact. Returns false
+ * if the channel has no coefficients, its APID never having come
+ */
+static bool Save_Channel_Coefs(const char *fname, uint32_t idx) {
+  uint16_t qtable[64];
+  int apid, q, i, a, b, t;
+
+  apid = Channel_Apid(idx);
+  if ((apid < 0) || (apid_coefs[apid].height == 0))
+    return false;
+
+  /* Greatest common divisor of the tables used */
+  for (i = 0; i < 64; i++) {
+    a = 0;
+    for (q = 0; q < 256; q++) {
+      if (!apid_q[apid][q]) continue;
+      b = dqt_cache[q][i];
+      while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+      }
+    }
+    qtable[i] = (uint16_t)(a ? a : 1);
+  }
+
+  Save_Image_Coefs(fname, &apid_coefs[apid], channel_image_height,
+      qtable, apid_inv[apid] != 0);
+
+  return true;
+}
+
+/*****************************************************************************/
+
+/* Map_Channels()
+ *
+ * Fills the contiguous channel images from the strips
+ * of the images of their APIDs
+ */
+static void Map_Channels(void) {
+  uint32_t idx;
+  const image_store_t *img;
+
+  for (idx = 0; idx < CHANNEL_IMAGE_NUM; idx++) {
+    mem_realloc((void **)&channel_image[idx], channel_image_size);
+
+    img = Channel_Store(idx);
+    if ((img != NULL) && (img->height > 0))
+      Store_Copy(img, channel_image[idx], channel_image_height);
+    else
+      memset(channel_image[idx], 0, channel_image_size);
+  }
+}
+
+/*****************************************************************************/
+
 void Mj_Dump_Image(void) {
   uint32_t idx;
+  uint32_t path_cnt[IDCT_PATHS];
+  char mesg[MESG_SIZE];
+
+  /* Wait for the packets still being decoded and let the
+   * workers go, then let the live writer finish the raw images */
+  Drain_Queue();
+  Stop_Workers();
+  if (Live_Active()) {
+    Publish_Rows(channel_image_height / LIVE_ROW_LINES, true);
+    Live_Close();
+  }
 
   /* Abort if no images successfully decoded */
   if (channel_image_size == 0)
     return;
 
+  /* Report how sparse the decoded blocks were */
+  Idct_Path_Counts(path_cnt);
+  snprintf(mesg, MESG_SIZE,
+      "IDCT blocks: DC only %u, 2x2 %u, 4x4 %u, full %u",
+      path_cnt[IDCT_PATH_DC], path_cnt[IDCT_PATH_2X2],
+      path_cnt[IDCT_PATH_4X4], path_cnt[IDCT_PATH_FULL]);
+  Print_Message(mesg, INFO_MESG);
+
+  Map_Channels();
+
   /* Save images in Raw state first, if enabled */
   if (isFlagSet(IMAGE_RAW))
       Save_Images(IMAGE_RAW);
@@ -234,50 +433,297 @@ static void Fill_Dqt_by_Q(int *dqt, int q) {
 
 /*****************************************************************************/
 
-static void Fill_Pix(double *img_dct, uint32_t apid, int mcu_id, int m) {
-  int i, j, t, x, y, off = 0, inv = 0;
+/* Get_Dqs()
+ *
+ * Returns the IDCT scaled dequantisation table of quality
+ * factor q, working it and the plain one in dqt_cache
+ * out the first time q comes up.
+ * Only called from Mj_Dec_Mcus(), so the worker threads
+ * just read tables filled before their packets were queued
+ */
+static const int16_t *Get_Dqs(uint8_t q) {
+  int dqt[64];
+  int i;
 
-  for( i = 0; i <= 63; i++ )
+  if( !dqs_cached[q] )
+  {
+    Fill_Dqt_by_Q( dqt, q );
+    Idct_Scale_Dqt( dqs_cache[q], dqt );
+    for( i = 0; i < 64; i++ )
+      dqt_cache[q][i] = (int16_t)dqt[i];
+    dqs_cached[q] = true;
+  }
+
+  return( dqs_cache[q] );
+}
+
+/*****************************************************************************/
+
+/* Dec_Block()
+ *
+ * Decodes the quantised coefficients of a block into coef, in
+ * natural order, for Idct_8x8() to dequantise, and the zig-zag
+ * index of its last non-zero one into last. Unless raw is NULL, the coefficients
+ * dequantised with dqt, for JPEG output, go there too. Returns
+ * false on bad codes and on data past the end of the packet
+ */
+static bool Dec_Block(
+    bit_io_rec_t *b,
+    const int16_t *dqt,
+    int *prev_dc,
+    int16_t *coef,
+    int16_t *raw,
+    uint8_t *last) {
+  uint16_t k, n;
+  int dc_cat, ac;
+  int ac_run, ac_size;
+  int i, v;
+
+  dc_cat = Huff_Decode( b, &huff_dc );
+  if( dc_cat == -1 )
+  {
+    Print_Message( "Decoder: bad DC huffman code!", ERROR_MESG );
+    return( false );
+  }
+  n = (uint16_t)(Bitop_FetchNBits(b, dc_cat));
+  if( b->pos > b->len ) return( false );
+
+  memset( coef, 0, 64 * sizeof(int16_t) );
+  *prev_dc += Map_Range( dc_cat, n );
+  coef[0] = (int16_t)( *prev_dc );
+  *last = 0;
+
+  if( raw != NULL )
   {
-    t = (int)( round(img_dct[i] + 128.0) );
-    if( t < 0 )   t = 0;
-    if( t > 255 ) t = 255;
-    x = ( mcu_id + m ) * 8 + i % 8;
-    y = cur_y + i / 8;
-    off = x + y * METEOR_IMAGE_WIDTH;
-
-    /* Invert image palette if APID matches */
-    for( j = 0; j < 3; j++ )
-      if( apid == rc_data.invert_palette[j] ) inv = 1;
-    if( inv )
+    memset( raw, 0, 64 * sizeof(int16_t) );
+    raw[0] = (int16_t)iClamp(
+        *prev_dc * dqt[0] + COEF_DC_BIAS, 1, INT16_MAX );
+  }
+
+  k = 1;
+  while( k < 64 )
+  {
+    ac = Huff_Decode( b, &huff_ac );
+    if( ac == -1 )
     {
-      if( apid == rc_data.apid[RED] )
-        channel_image[RED][off]   = 255 - (uint8_t)t;
-      else if( apid == rc_data.apid[GREEN] )
-        channel_image[GREEN][off] = 255 - (uint8_t)t;
-      else if( apid == rc_data.apid[BLUE] )
-        channel_image[BLUE][off]  = 255 - (uint8_t)t;
+      Print_Message( "Decoder: bad AC huffman code!", ERROR_MESG );
+      return( false );
     }
-    else /* Normal palette */
+    ac_size = ac & 0x0F;
+    ac_run  = ac >> 4;
+
+    if( (ac_run == 0) && (ac_size == 0) ) break;
+
+    //Stop on data past the packet or coefficients past the block
+    if( (b->pos > b->len) || (k + ac_run >= 64) ) return( false );
+
+    //Skipped coefficients stay zero
+    k += (uint16_t)ac_run;
+
+    if( ac_size != 0 )
     {
-      if( apid == rc_data.apid[RED] )
-        channel_image[RED][off]   = (uint8_t)t;
-      else if( apid == rc_data.apid[GREEN] )
-        channel_image[GREEN][off] = (uint8_t)t;
-      else if( apid == rc_data.apid[BLUE] )
-        channel_image[BLUE][off]  = (uint8_t)t;
+      n = (uint16_t)(Bitop_FetchNBits(b, ac_size));
+      i = natural_order[k];
+      v = Map_Range( ac_size, n );
+      coef[i] = (int16_t)( v );
+      if( raw != NULL )
+        raw[i] = (int16_t)iClamp( v * dqt[i], INT16_MIN, INT16_MAX );
+      *last = (uint8_t)k;
+      k++;
     }
+    else if( ac_run == 15 )
+      k++;
   }
+
+  return( true );
+}
+
+/*****************************************************************************/
+
+/* Dec_Packet()
+ *
+ * Decodes the MCUs of an image packet straight into the image,
+ * already inverted if need be, and keeps their coefficients if
+ * asked to. Blocks decoded before any error in the packet are kept
+ */
+static void Dec_Packet(const mcu_job_t *job) {
+  bit_io_rec_t b;
+  int m;
+  int prev_dc;
+  int16_t coef[MCU_PER_PACKET][64];
+  int16_t raw[MCU_PER_PACKET][64];
+  uint8_t last[MCU_PER_PACKET];
+
+  Bitop_Init( &b, job->data, job->len );
+
+  prev_dc = 0;
+  for( m = 0; m < MCU_PER_PACKET; m++ )
+    if( !Dec_Block(&b, job->dqt, &prev_dc, coef[m],
+          job->coefs ? raw[m] : NULL, &last[m]) ) break;
+
+  if( m > 0 )
+    Idct_8x8( (const int16_t (*)[64])coef, job->dqs, last, m,
+        job->out, METEOR_IMAGE_WIDTH, job->inv );
+
+  if( job->coefs != NULL )
+    memcpy( job->coefs, raw, (size_t)m * sizeof(raw[0]) );
 }
 
 /*****************************************************************************/
 
+/* Mcu_Worker()
+ *
+ * Decoding thread, takes packets off the queue until told to stop
+ * and there are none left
+ */
+static void *Mcu_Worker(void *arg) {
+  mcu_job_t job = { NULL, 0, 0, NULL, NULL, NULL, NULL, 0, 0 };
+  mcu_job_t *slot;
+  uint8_t *data;
+  size_t size;
+
+  (void)arg;
+
+  pthread_mutex_lock( &queue_lock );
+  while( true )
+  {
+    while( (queue_cnt == 0) && !queue_stop )
+      pthread_cond_wait( &queue_filled, &queue_lock );
+    if( queue_cnt == 0 ) break;
+
+    //Take the packet, leaving the slot our old buffer to fill
+    slot = &mcu_queue[queue_head];
+    data = job.data;
+    size = job.size;
+    job  = *slot;
+    slot->data = data;
+    slot->size = size;
+
+    queue_head = ( queue_head + 1 ) % MCU_QUEUE_LEN;
+    queue_cnt--;
+    queue_busy++;
+    pthread_cond_signal( &queue_freed );
+    pthread_mutex_unlock( &queue_lock );
+
+    Dec_Packet( &job );
+
+    pthread_mutex_lock( &queue_lock );
+    row_jobs[job.row % ROW_JOBS_RING]--;
+    queue_busy--;
+    if( (queue_cnt == 0) && (queue_busy == 0) )
+      pthread_cond_signal( &queue_freed );
+  }
+  pthread_mutex_unlock( &queue_lock );
+
+  free_ptr( (void **)&job.data );
+
+  return( NULL );
+}
+
+/*****************************************************************************/
+
+/* Start_Workers()
+ *
+ * Starts the image packet decoding threads set in the config.
+ * With a single thread packets are decoded as they arrive
+ */
+static void Start_Workers(void) {
+  long cpus;
+  int n, idx;
+  char mesg[MESG_SIZE];
+
+  n = rc_data.decode_threads;
+  if( n == 0 )
+  {
+    cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    n = iClamp( (int)cpus, 1, DECODE_THREADS_MAX );
+  }
+  if( n < 2 ) return;
+
+  queue_stop = false;
+  for( idx = 0; idx < n; idx++ )
+  {
+    if( pthread_create(&mcu_thread[idx], NULL, Mcu_Worker, NULL) != 0 )
+    {
+      Print_Message( "Failed to start image decoding thread", ERROR_MESG );
+      break;
+    }
+    mcu_threads++;
+  }
+
+  snprintf( mesg, MESG_SIZE,
+      "Decoding image packets on %d threads", mcu_threads );
+  Print_Message( mesg, INFO_MESG );
+}
+
+/*****************************************************************************/
+
+/* Stop_Workers()
+ *
+ * Lets the decoding threads finish the queued packets and exit
+ */
+static void Stop_Workers(void) {
+  int idx;
+
+  pthread_mutex_lock( &queue_lock );
+  queue_stop = true;
+  pthread_cond_broadcast( &queue_filled );
+  pthread_mutex_unlock( &queue_lock );
+
+  for( idx = 0; idx < mcu_threads; idx++ )
+    pthread_join( mcu_thread[idx], NULL );
+  mcu_threads = 0;
+
+  for( idx = 0; idx < MCU_QUEUE_LEN; idx++ )
+  {
+    free_ptr( (void **)&mcu_queue[idx].data );
+    mcu_queue[idx].size = 0;
+  }
+  queue_head = 0;
+  queue_cnt  = 0;
+  queue_stop = false;
+}
+
+/*****************************************************************************/
+
+/* Drain_Queue()
+ *
+ * Waits for the decoding threads to finish all queued packets
+ */
+static void Drain_Queue(void) {
+  pthread_mutex_lock( &queue_lock );
+  while( (queue_cnt > 0) || (queue_busy > 0) )
+    pthread_cond_wait( &queue_freed, &queue_lock );
+  pthread_mutex_unlock( &queue_lock );
+}
+
+/*****************************************************************************/
+
+/* Grow_Image()
+ *
+ * Grows APID image idx, and its coefficients if they
+ * are kept, to channel_image_height lines
+ */
+static void Grow_Image(int idx) {
+  Store_Grow( &apid_image[idx], channel_image_height );
+  if( isFlagSet(IMAGE_JPEG_LOSSLESS) )
+    Store_Grow( &apid_coefs[idx],
+        channel_image_height / 8 * COEF_ROW_LINES );
+}
+
+/*****************************************************************************/
+
+/* Progress_Image()
+ *
+ * Works out the image line of a packet into cur_y, growing the
+ * images as needed. Growing doesn't move lines already stored,
+ * so the decoding threads carry on writing into them
+ */
 static bool Progress_Image(uint32_t apid, int mcu_id, int pck_cnt) {
-  static size_t prev_len = 0;
-  size_t delta_len = 0, i, s;
   int j;
 
-  if( (apid == 0) || (apid == 70) )
+  if( (apid < APID_IMAGE_FIRST) ||
+      (apid >= APID_IMAGE_FIRST + APID_IMAGE_NUM) )
     return false;
 
   if( last_mcu == -1 )
@@ -291,7 +737,6 @@ static bool Progress_Image(uint32_t apid, int mcu_id, int pck_cnt) {
       first_pck -= 28;
     last_mcu = 0;
     cur_y = -1;
-    prev_len = 0;
   }
 
   if( pck_cnt < prev_pck ) first_pck -= 16384;
@@ -303,123 +748,172 @@ static bool Progress_Image(uint32_t apid, int mcu_id, int pck_cnt) {
     channel_image_height = (uint32_t)( cur_y + 8 );
     channel_image_size = (size_t)
       ( channel_image_width * channel_image_height );
-    for( i = 0; i < CHANNEL_IMAGE_NUM; i++ )
-      mem_realloc( (void **)&channel_image[i], channel_image_size );
 
-    /* Clear new allocation */
-    delta_len = channel_image_size - prev_len;
-    for( i = 0; i < delta_len; i++ )
-    {
-      s = i + prev_len;
-      for( j = 0; j < CHANNEL_IMAGE_NUM; j++ )
-        channel_image[j][s] = 0;
-    }
-
-    prev_len = channel_image_size;
+    /* Grow the APID images received so far */
+    for( j = 0; j < APID_IMAGE_NUM; j++ )
+      if( apid_image[j].height > 0 )
+        Grow_Image( j );
   }
   last_y = cur_y;
 
+  /* First packet of this APID */
+  if( apid_image[apid - APID_IMAGE_FIRST].height == 0 )
+    Grow_Image( (int)(apid - APID_IMAGE_FIRST) );
+
   return true;
 }
 
 /*****************************************************************************/
 
+/* Publish_Rows()
+ *
+ * Hands the MCU rows up to rows, with none of their packets
+ * still to decode, to the live image writer. Stops early if
+ * the writer has no room for more, unless told to wait
+ */
+static void Publish_Rows(uint32_t rows, bool wait) {
+  uint8_t *row[CHANNEL_IMAGE_NUM];
+  const image_store_t *img;
+  uint32_t idx;
+  int pending;
+
+  while( live_rows < rows )
+  {
+    pthread_mutex_lock( &queue_lock );
+    pending = row_jobs[live_rows % ROW_JOBS_RING];
+    pthread_mutex_unlock( &queue_lock );
+    if( pending > 0 ) break;
+
+    for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+    {
+      img = Channel_Store( idx );
+      row[idx] = NULL;
+      if( (img != NULL) && (img->height > 0) )
+        row[idx] = Store_Line( img, live_rows * LIVE_ROW_LINES );
+    }
+
+    if( !Live_Put_Row(row, wait) ) break;
+    live_rows++;
+  }
+}
+
+/*****************************************************************************/
+
+/* Mj_Dec_Mcus()
+ *
+ * Decodes the MCUs of an image packet with len bytes of data at p,
+ * or queues it for the decoding threads. Working out where the
+ * packet goes stays here, so the threads write to disjoint parts
+ * of the images. Decoding stops if the data would run past the
+ * end of the packet
+ */
 void Mj_Dec_Mcus(
         uint8_t *p,
+        int len,
         uint32_t apid,
         int pck_cnt,
         int mcu_id,
-        uint8_t q) {
-  bit_io_rec_t b;
-  int i, m;
-  uint16_t k, n;
-  double prev_dc;
-  int dc_cat, ac;
-  double dct[64];
-  double zdct[64];
-  double img_dct[64];
-  int dqt[64];
-  int ac_run, ac_size, ac_len;
+        uint8_t q,
+        uint8_t inv) {
+  mcu_job_t job;
 
-  b.p = p;
-  b.pos = 0;
+  //The packet's MCUs must lie within an image line
+  if( mcu_id + MCU_PER_PACKET > METEOR_IMAGE_WIDTH / 8 )
+    return;
 
   if( !Progress_Image(apid, mcu_id, pck_cnt) )
     return;
 
-  Fill_Dqt_by_Q( dqt, q );
-
-  prev_dc = 0;
-  m = 0;
-  while( m < MCU_PER_PACKET )
+  job.data = p;
+  job.len  = len;
+  job.dqs  = Get_Dqs( q );
+  job.dqt  = dqt_cache[q];
+  job.out  = Store_Line( &apid_image[apid - APID_IMAGE_FIRST],
+      (uint32_t)cur_y ) + mcu_id * 8;
+  job.row  = (uint32_t)cur_y / 8;
+  job.inv  = inv;
+
+  job.coefs = NULL;
+  if( isFlagSet(IMAGE_JPEG_LOSSLESS) )
   {
-    dc_cat = Get_DC( (uint16_t)(Bitop_PeekNBits(&b, 16)) );
-    if( dc_cat == -1 )
-    {
-      Print_Message( "Decoder: bad DC huffman code!", ERROR_MESG );
-      return;
-    }
-    Bitop_AdvanceNBits(&b, dc_cat_off[dc_cat]);
-    n = (uint16_t)(Bitop_FetchNBits(&b, dc_cat));
-
-    zdct[0] = Map_Range( dc_cat, n ) + prev_dc;
-    prev_dc = zdct[0];
+    job.coefs = (int16_t *)Store_Line(
+        &apid_coefs[apid - APID_IMAGE_FIRST], job.row * COEF_ROW_LINES ) +
+      mcu_id * 64;
+    apid_q[apid - APID_IMAGE_FIRST][q] = true;
+    apid_inv[apid - APID_IMAGE_FIRST] = inv;
+  }
 
-    k = 1;
-    while( k < 64 )
-    {
-      ac = Get_AC( (uint16_t)(Bitop_PeekNBits(&b, 16)) );
-      if( ac == -1 )
-      {
-        Print_Message( "Decoder: bad DC huffman code!", ERROR_MESG );
-        return;
-      }
-      ac_len  = ac_table[ac].len;
-      ac_size = ac_table[ac].size;
-      ac_run  = ac_table[ac].run;
-      Bitop_AdvanceNBits(&b, ac_len);
+  if( mcu_threads == 0 )
+    Dec_Packet( &job );
+  else
+    Queue_Packet( &job );
 
-      if( (ac_run == 0) && (ac_size == 0) )
-      {
-        for( i = k; i <= 63; i++ ) zdct[i] = 0;
-        break;
-      }
+  //Rows above this packet's are complete once their packets are decoded
+  if( Live_Active() )
+    Publish_Rows( job.row, false );
+}
 
-      for( i = 0; i < ac_run; i++ )
-      {
-        zdct[k] = 0;
-        k++;
-      }
+/*****************************************************************************/
 
-      if( ac_size != 0 )
-      {
-        n = (uint16_t)(Bitop_FetchNBits(&b, ac_size));
-        zdct[k] = Map_Range( ac_size, n );
-        k++;
-      }
-      else if( ac_run == 15 )
-      {
-        zdct[k] = 0;
-        k++;
-      }
-    }
+/* Queue_Packet()
+ *
+ * Copies a packet into a free slot of the queue for the decoding
+ * threads, as the frame buffer is reused. Waits if the queue is full
+ */
+static void Queue_Packet(const mcu_job_t *job) {
+  mcu_job_t *slot;
 
-    for( i = 0; i <= 63; i++ )
-      dct[i] = zdct[ zigzag[i] ] * dqt[i];
+  pthread_mutex_lock( &queue_lock );
+  while( queue_cnt == MCU_QUEUE_LEN )
+    pthread_cond_wait( &queue_freed, &queue_lock );
 
-    Flt_Idct_8x8( img_dct, dct );
-    Fill_Pix( img_dct, apid, mcu_id, m );
-    m++;
+  slot = &mcu_queue[(queue_head + queue_cnt) % MCU_QUEUE_LEN];
+  if( slot->size < (size_t)job->len )
+  {
+    mem_realloc( (void **)&slot->data, (size_t)job->len );
+    slot->size = (size_t)job->len;
   }
+  memcpy( slot->data, job->data, (size_t)job->len );
+  slot->len = job->len;
+  slot->dqs = job->dqs;
+  slot->dqt = job->dqt;
+  slot->out = job->out;
+  slot->coefs = job->coefs;
+  slot->row = job->row;
+  slot->inv = job->inv;
+
+  row_jobs[job->row % ROW_JOBS_RING]++;
+  queue_cnt++;
+  pthread_cond_signal( &queue_filled );
+  pthread_mutex_unlock( &queue_lock );
 }
 
 /*****************************************************************************/
 
 void Mj_Init(void) {
+  int idx;
+
+  Stop_Workers();
+  for( idx = 0; idx < APID_IMAGE_NUM; idx++ )
+  {
+    Store_Release( &apid_image[idx] );
+    Store_Release( &apid_coefs[idx] );
+  }
+  memset( apid_q, 0, sizeof(apid_q) );
+
   Default_Huffman_Table();
   last_mcu  = -1;
   cur_y     = 0;
   last_y    = -1;
   first_pck = 0;
   prev_pck  = 0;
+
+  memset( row_jobs, 0, sizeof(row_jobs) );
+  live_rows = 0;
+
+  Start_Workers();
+
+  /* All the files of the pass are named by its start */
+  File_Time_Stamp();
+  Live_Open();
 }
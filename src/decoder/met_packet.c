@@ -16,6 +16,7 @@
 
 #include "met_packet.h"
 
+#include "../common/common.h"
 #include "../common/shared.h"
 #include "met_jpg.h"
 
@@ -28,23 +29,49 @@
 
 #define PACKET_FULL_MARK    2047
 
+#define VCDU_HDR_LEN        10  // VCDU primary, insert zone and M_PDU headers
+#define PACKET_HDR_LEN      6   // CCSDS packet primary header
+#define APD_HDR_LEN         14  // Primary and secondary packet headers
+
+/* Longest packet the 16 bit length field allows */
+#define PACKET_MAX_LEN      (PACKET_HDR_LEN + 65536)
+
 /*****************************************************************************/
 
-static void Parse_70(uint8_t *p);
-static void Act_Apd(uint8_t *p, uint32_t apid, int pck_cnt);
-static void Parse_Apd(uint8_t *p);
-static int Parse_Partial(uint8_t *p, int len);
+static void Parse_70(uint8_t *p, int len, uint32_t apid, int pck_cnt);
+static void Act_Apd(uint8_t *p, int len, uint32_t apid, int pck_cnt);
+static void Parse_Apd(uint8_t *p, int len);
+static int Packet_Len(const uint8_t *p, int avail);
+static void Append_Partial(const uint8_t *p, int len);
 
 /*****************************************************************************/
 
 static bool partial_packet = false;
 static int last_frame = 0;
 
+/* Reassembly buffer of a packet spanning frames */
+static uint8_t packet_buf[PACKET_MAX_LEN];
+static int packet_off = 0;
+
+/* Packet handlers of APIDs 64-70, others are ignored */
+static void (* const apid_handler[APID_TELEMETRY - APID_IMAGE_FIRST + 1])
+    (uint8_t *p, int len, uint32_t apid, int pck_cnt) = {
+    Act_Apd, Act_Apd, Act_Apd, Act_Apd, Act_Apd, Act_Apd, Parse_70
+};
+
+/* Palette inversion mask of imaging APIDs, XORed into pixels */
+static uint8_t apid_invert[APID_IMAGE_NUM];
+
 /*****************************************************************************/
 
-static void Parse_70(uint8_t *p) {
+static void Parse_70(uint8_t *p, int len, uint32_t apid, int pck_cnt) {
   int h, m, s, ms;
 
+  (void)apid;
+  (void)pck_cnt;
+
+  if( len < 12 ) return;
+
   h  = p[8];
   m  = p[9];
   s  = p[10];
@@ -61,22 +88,31 @@ static void Parse_70(uint8_t *p) {
 
 /*****************************************************************************/
 
-static void Act_Apd(uint8_t *p, uint32_t apid, int pck_cnt) {
+static void Act_Apd(uint8_t *p, int len, uint32_t apid, int pck_cnt) {
   int mcu_id, q;
 
+  if( len < 6 ) return;
+
   mcu_id   = p[0];
   q = p[5];
 
-  Mj_Dec_Mcus( &p[6], apid, pck_cnt, mcu_id, (uint8_t)q );
+  Mj_Dec_Mcus( &p[6], len - 6, apid, pck_cnt, mcu_id, (uint8_t)q,
+      apid_invert[apid - APID_IMAGE_FIRST] );
 }
 
 /*****************************************************************************/
 
-static void Parse_Apd(uint8_t *p) {
+/* Parse_Apd()
+ *
+ * Hands a whole packet of len bytes to the handler of its APID
+ */
+static void Parse_Apd(uint8_t *p, int len) {
   uint16_t w;
   int pck_cnt;
   uint32_t apid;
 
+  if( len < APD_HDR_LEN ) return;
+
   w = (uint16_t)p[0];
   w <<= 8;
   w |= (uint16_t)p[1];
@@ -88,47 +124,79 @@ static void Parse_Apd(uint8_t *p) {
   pck_cnt |= p[3];
   pck_cnt &= 0x3FFF;
 
-  if( apid == 70 )
-    Parse_70( &p[14] );
-  else
-    Act_Apd( &p[14], apid, pck_cnt );
+  if( (apid < APID_IMAGE_FIRST) || (apid > APID_TELEMETRY) )
+    return;
+
+  apid_handler[apid - APID_IMAGE_FIRST](
+      &p[APD_HDR_LEN], len - APD_HDR_LEN, apid, pck_cnt );
 }
 
 /*****************************************************************************/
 
-static int Parse_Partial(uint8_t *p, int len) {
-  int len_pck;
+/* Packet_Len()
+ *
+ * Returns the length of the packet starting at p, or -1
+ * if its header isn't within the avail bytes there
+ */
+static int Packet_Len(const uint8_t *p, int avail) {
+  if( avail < PACKET_HDR_LEN )
+    return( -1 );
 
-  if( len < 6 )
-  {
-    partial_packet = true;
-    return( 0 );
-  }
+  return( ((p[4] << 8) | p[5]) + PACKET_HDR_LEN + 1 );
+}
 
-  len_pck = ( p[4] << 8 ) | p[5];
-  if( len_pck >= len - 6 )
+/*****************************************************************************/
+
+/* Append_Partial()
+ *
+ * Adds a fragment of a packet spanning frames to the
+ * reassembly buffer, dropping the packet if it overruns
+ */
+static void Append_Partial(const uint8_t *p, int len) {
+  if( packet_off + len > PACKET_MAX_LEN )
   {
-    partial_packet = true;
-    return( 0 );
+    partial_packet = false;
+    packet_off = 0;
+    return;
   }
 
-  Parse_Apd( p );
+  memcpy( &packet_buf[packet_off], p, (size_t)len );
+  packet_off += len;
+}
+
+/*****************************************************************************/
 
-  partial_packet = false;
-  return( len_pck + 6 + 1 );
+/* Mp_Init()
+ *
+ * Resolves the palette inversion of the imaging APIDs from the config
+ */
+void Mp_Init(void) {
+  int i, j;
+
+  for( i = 0; i < APID_IMAGE_NUM; i++ )
+  {
+    apid_invert[i] = 0;
+    for( j = 0; j < 3; j++ )
+      if( rc_data.invert_palette[j] == (uint32_t)(APID_IMAGE_FIRST + i) )
+        apid_invert[i] = 0xFF;
+  }
 }
 
 /*****************************************************************************/
 
+/* Parse_Cvcdu()
+ *
+ * Extracts the packets of a VCDU. Packets that lie within the VCDU are
+ * parsed in place; only the fragments of packets spanning VCDUs are
+ * copied to the reassembly buffer, to be parsed once complete
+ */
 void Parse_Cvcdu(uint8_t *p, int len) {
   int n, data_len, off;
   int ver, fid;
   int frame_cnt;
-  uint16_t hdr_off;
+  int hdr_off;
   uint16_t w;
-
-  static uint8_t packet_buf[2048];
-  static int packet_off = 0;
+  uint8_t *data;
 
   w = (uint16_t)( (p[0] << 8) | p[1] );
   ver = w >> 14;
@@ -141,48 +209,58 @@ void Parse_Cvcdu(uint8_t *p, int len) {
 
   if( (ver == 0) | (fid == 0) ) return; //Empty packet
 
-  data_len = len - 10;
-  if( frame_cnt == last_frame + 1 )
+  data = &p[VCDU_HDR_LEN];
+  data_len = len - VCDU_HDR_LEN;
+
+  //A first header pointer past the data means a broken frame
+  if( (hdr_off != PACKET_FULL_MARK) && (hdr_off > data_len) )
+  {
+    partial_packet = false;
+    return;
+  }
+
+  if( (frame_cnt == last_frame + 1) && partial_packet )
   {
-    if( partial_packet )
+    if( hdr_off == PACKET_FULL_MARK ) //Packet could be larger than one frame
+    {
+      Append_Partial( data, data_len );
+      hdr_off = data_len;
+    }
+    else
     {
-      if( hdr_off == PACKET_FULL_MARK ) //Packet could be larger than one frame
-      {
-        hdr_off = (uint16_t)( len - 10 );
-        memmove( &packet_buf[packet_off], &p[10], hdr_off );
-        packet_off += hdr_off;
-      }
-      else
-      {
-        memmove( &packet_buf[packet_off], &p[10], hdr_off );
-        Parse_Partial( packet_buf, packet_off + hdr_off );
-      }
+      //The spanning packet ends where the first new one starts
+      Append_Partial( data, hdr_off );
+      n = Packet_Len( packet_buf, packet_off );
+      if( partial_packet && (n > 0) && (n <= packet_off) )
+        Parse_Apd( packet_buf, n );
+      partial_packet = false;
     }
   }
   else
   {
+    partial_packet = false;
     if( hdr_off == PACKET_FULL_MARK ) //Packet could be larger than one frame
+    {
+      last_frame = frame_cnt;
       return;
-    partial_packet = false;
-    packet_off = 0;
+    }
   }
   last_frame = frame_cnt;
 
-  data_len -= hdr_off;
   off = hdr_off;
-  while( data_len > 0 )
+  while( off < data_len )
   {
-    n = Parse_Partial( &p[10 + off], data_len );
-    if( partial_packet )
+    n = Packet_Len( &data[off], data_len - off );
+    if( (n < 0) || (n > data_len - off) )
     {
-      packet_off = data_len;
-      memmove( packet_buf, &p[10 + off], (size_t)packet_off );
+      //Keep the start of a packet that goes on in the next frame
+      partial_packet = true;
+      packet_off = 0;
+      Append_Partial( &data[off], data_len - off );
       break;
     }
-    else
-    {
-      off += n;
-      data_len -= n;
-    }
+
+    Parse_Apd( &data[off], n );
+    off += n;
   }
 }
@@ -23,6 +23,7 @@
 
 /*****************************************************************************/
 
+void Mp_Init(void);
 void Parse_Cvcdu(uint8_t *p, int len);
 
 /*****************************************************************************/
@@ -16,6 +16,7 @@
 
 #include "met_to_data.h"
 
+#include "../common/common.h"
 #include "../mlrpt/utils.h"
 #include "bitop.h"
 #include "correlator.h"
@@ -27,16 +28,38 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 
 /*****************************************************************************/
 
 #define MIN_CORRELATION 45
+#define HARD_FRAME_BITS (HARD_FRAME_LEN * 8)
+
+/* Frame sync is tracked in the decoded bit stream */
+#define SYNC_WORD       0x1ACFFC1D
+#define SYNC_WINDOW     16  // Bits searched either side of predicted ASM
+#define SYNC_MAX_ERRORS 4   // Bit errors tolerated in a found ASM
+
+/* Consecutive RS failures that the flywheel rides out
+ * before sync is searched for over whole frames again */
+#define FLYWHEEL_FRAMES 4
+
+/* Soft symbols correlated around the predicted ASM
+ * when a frame fails without an ASM in the bit stream */
+#define SEARCH_WINDOW   2048
+
+/* Soft symbols are valid up to the end of the
+ * middle section of the demodulator's buffer */
+#define SOFT_BUF_END    (2 * SOFT_FRAME_LEN)
 
 /*****************************************************************************/
 
-static void Do_Full_Correlate(mtd_rec_t *mtd, uint8_t *raw, uint8_t *aligned);
-static void Do_Next_Correlate(mtd_rec_t *mtd, uint8_t *raw, uint8_t *aligned);
-static bool Try_Frame(mtd_rec_t *mtd, uint8_t *aligned);
+static void Sync_Enter(mtd_rec_t *mtd, int state);
+static bool Do_Correlate(mtd_rec_t *mtd, uint8_t *raw, int start, int len);
+static void Do_Full_Correlate(mtd_rec_t *mtd, uint8_t *raw);
+static bool Do_Stream_Decode(mtd_rec_t *mtd, uint8_t *raw, uint32_t want);
+static bool Find_Sync(mtd_rec_t *mtd);
+static bool Try_Frame(mtd_rec_t *mtd);
 
 /*****************************************************************************/
 
@@ -75,11 +98,16 @@ static const uint8_t prand[255] = {
     0x08, 0x78, 0xc4, 0x4a, 0x66, 0xf5, 0x58
 };
 
+/* prand[] expanded over a whole frame, plain [0] and inverted [1] */
+static uint8_t prand_frame[2][ECC_FRAME_LEN];
+
 static uint8_t *decoded = NULL;
 
 /*****************************************************************************/
 
 void Mtd_Init(mtd_rec_t *mtd) {
+  int j;
+
   //sync is $1ACFFC1D,  00011010 11001111 11111100 00011101
   Correlator_Init( &(mtd->c), (uint64_t)0xfca2b63db00d9794 );
   Mk_Viterbi27( &(mtd->v) );
@@ -87,119 +115,271 @@ void Mtd_Init(mtd_rec_t *mtd) {
   mtd->cpos = 0;
   mtd->word = 0;
   mtd->corr = 64;
+  mtd->frame_bit = 0;
+  mtd->frame_out = false;
+  mtd->sync_state  = SYNC_SEARCH;
+  mtd->sync_fails  = 0;
+  bzero( mtd->sync_entries, sizeof(mtd->sync_entries) );
+  mtd->full_searches   = 0;
+  mtd->window_searches = 0;
+
+  for( j = 0; j < ECC_FRAME_LEN; j++ )
+  {
+    prand_frame[0][j] = prand[j % 255];
+    prand_frame[1][j] = prand[j % 255] ^ 0xFF;
+  }
+}
+
+/*****************************************************************************/
+
+/* Sync_Enter()
+ *
+ * Moves the frame sync state machine to state,
+ * counting the transition and reporting lock changes
+ */
+static void Sync_Enter(mtd_rec_t *mtd, int state) {
+  if( state == mtd->sync_state ) return;
+
+  if( state == SYNC_LOCK )
+  {
+    if( mtd->sync_state == SYNC_CHECK )
+      Print_Message( "Frame Sync Locked", INFO_MESG );
+    mtd->sync_fails = 0;
+  }
+  else if( (state == SYNC_SEARCH) && (mtd->sync_state != SYNC_CHECK) )
+    Print_Message( "Frame Sync Lost", INFO_MESG );
+
+  mtd->sync_state = state;
+  mtd->sync_entries[state]++;
 }
 
 /*****************************************************************************/
 
-static void Do_Full_Correlate(mtd_rec_t *mtd, uint8_t *raw, uint8_t *aligned) {
+/* Do_Correlate()
+ *
+ * Searches len soft symbols from raw[start] for the ASM and, when
+ * found, restarts the streaming Viterbi decoder at it. The ASM is
+ * then the first thing decoded, VIT_STREAM_DELAY bits into the
+ * stream. Returns true if the ASM was found
+ */
+static bool Do_Correlate(mtd_rec_t *mtd, uint8_t *raw, int start, int len) {
   mtd->word = (uint16_t)
-    ( Corr_Correlate(&(mtd->c), &(raw[mtd->pos]), SOFT_FRAME_LEN) );
+    ( Corr_Correlate(&(mtd->c), &(raw[start]), (uint32_t)len) );
   mtd->cpos = (uint16_t)( mtd->c.position[mtd->word] );
   mtd->corr = (uint16_t)( mtd->c.correlation[mtd->word] );
 
   if( mtd->corr < MIN_CORRELATION )
+    return( false );
+
+  mtd->pos = start + (int)mtd->cpos;
+  mtd->prev_pos = mtd->pos;
+
+  Vit_Stream_Reset( &(mtd->v) );
+  mtd->frame_bit = VIT_STREAM_DELAY;
+  mtd->sync_fails = 0;
+  Sync_Enter( mtd, SYNC_CHECK );
+
+  return( true );
+}
+
+/*****************************************************************************/
+
+/* Do_Full_Correlate()
+ *
+ * Searches a whole soft frame for the ASM,
+ * moving on by a quarter frame if not found
+ */
+static void Do_Full_Correlate(mtd_rec_t *mtd, uint8_t *raw) {
+  mtd->full_searches++;
+  if( !Do_Correlate(mtd, raw, mtd->pos, SOFT_FRAME_LEN) )
   {
     mtd->prev_pos = mtd->pos;
-    memmove( aligned, &(raw[mtd->pos]), SOFT_FRAME_LEN );
     mtd->pos += SOFT_FRAME_LEN / 4;
   }
-  else
-  {
-    mtd->prev_pos = mtd->pos + (int)mtd->cpos;
-
-    memmove(
-        aligned,
-        &(raw[mtd->pos + (int)mtd->cpos]),
-        SOFT_FRAME_LEN - mtd->cpos );
-    memmove(
-        &(aligned[SOFT_FRAME_LEN - mtd->cpos]),
-        &(raw[mtd->pos + SOFT_FRAME_LEN]),
-        mtd->cpos );
-    mtd->pos += SOFT_FRAME_LEN + mtd->cpos;
-
-    Fix_Packet( aligned, SOFT_FRAME_LEN, (int)mtd->word );
-  }
 }
 
 /*****************************************************************************/
 
-static void Do_Next_Correlate(mtd_rec_t *mtd, uint8_t *raw, uint8_t *aligned) {
-  mtd->cpos = 0;
-  memmove( aligned, &(raw[mtd->pos]), SOFT_FRAME_LEN );
-  mtd->prev_pos = mtd->pos;
-  mtd->pos += SOFT_FRAME_LEN;
+/* Do_Stream_Decode()
+ *
+ * Feeds soft symbols from raw[pos] to the streaming Viterbi decoder
+ * until want bits are decoded or the available symbols are used up.
+ * Returns true if the decoded stream reached want
+ */
+static bool Do_Stream_Decode(mtd_rec_t *mtd, uint8_t *raw, uint32_t want) {
+  mtd->pos += Vit_Stream_Decode( &(mtd->v), &(raw[mtd->pos]),
+      SOFT_BUF_END - mtd->pos, (int)mtd->word, want );
 
-  Fix_Packet( aligned, SOFT_FRAME_LEN, (int)mtd->word );
+  return( (int32_t)(mtd->v.out_pos - want) >= 0 );
 }
 
 /*****************************************************************************/
 
-static bool Try_Frame(mtd_rec_t *mtd, uint8_t *aligned) {
-  int j;
-  uint8_t ecc_buf[256];
+/* Find_Sync()
+ *
+ * Looks for the ASM (or its inverse) in the decoded stream within
+ * SYNC_WINDOW bits of the predicted position, nearest offsets first.
+ * Moves frame_bit onto the best match and returns true if one is found
+ */
+static bool Find_Sync(mtd_rec_t *mtd) {
+  int k, d, lo, best_d, err, best_err;
+  uint32_t w;
+
+  //The first frame of a stream cannot start before the stream
+  lo = SYNC_WINDOW;
+  if( mtd->frame_bit - VIT_STREAM_DELAY < SYNC_WINDOW )
+    lo = (int)( mtd->frame_bit - VIT_STREAM_DELAY );
+
+  best_d = 0;
+  best_err = SYNC_MAX_ERRORS + 1;
+  for( k = 0; (k <= SYNC_WINDOW) && (best_err > 0); k++ )
+  {
+    for( d = k; d >= -k; d -= 2 * k )
+    {
+      if( -d > lo ) break;
+
+      w = Vit_Stream_Peek32( &(mtd->v), mtd->frame_bit + (uint32_t)d );
+      err = Bitop_CountBits( w ^ SYNC_WORD );
+      if( 32 - err < err ) err = 32 - err;
+
+      if( err < best_err )
+      {
+        best_err = err;
+        best_d = d;
+      }
+
+      if( k == 0 ) break;
+    }
+  }
+
+  if( best_err > SYNC_MAX_ERRORS )
+    return( false );
+
+  mtd->frame_bit += (uint32_t)best_d;
+  return( true );
+}
+
+/*****************************************************************************/
+
+static bool Try_Frame(mtd_rec_t *mtd) {
+  uint8_t cw[ECC_DEPTH][ECC_CW_LEN];
   uint32_t temp;
+  int inverted;
 
   if( decoded == NULL )
     mem_alloc( (void **)&decoded, HARD_FRAME_LEN );
 
-  Vit_Decode( &(mtd->v), aligned, decoded );
+  Vit_Stream_Read( &(mtd->v), mtd->frame_bit, decoded, HARD_FRAME_LEN );
+
+  if( isFlagSet(DECODE_MEASURE_BER) )
+  {
+    Vit_Stream_BER( &(mtd->v), mtd->frame_bit, HARD_FRAME_BITS );
+    mtd->sig_q = (int)(round(100.0 - Vit_Get_Percent_BER(&(mtd->v))));
+  }
 
   temp =
     ((uint32_t)decoded[3] << 24) +
     ((uint32_t)decoded[2] << 16) +
     ((uint32_t)decoded[1] <<  8) +
     (uint32_t)decoded[0];
-  mtd->last_sync = temp;
-  mtd->sig_q = (int)(round(100.0 - Vit_Get_Percent_BER(&(mtd->v))));
 
   //Curiously enough, you can flip all bits in a packet
   //and get a correct ECC anyway. Check for that case
-  if( Bitop_CountBits(mtd->last_sync ^ 0xE20330E5) <
-      Bitop_CountBits(mtd->last_sync ^ 0x1DFCCF1A) )
-  {
-    for( j = 0; j < HARD_FRAME_LEN; j++ )
-      decoded[j] ^= 0xFF;
-    temp =
-      ((uint32_t)decoded[3] << 24) +
-      ((uint32_t)decoded[2] << 16) +
-      ((uint32_t)decoded[1] <<  8) +
-      (uint32_t)decoded[0];
-    mtd->last_sync = temp;
-  }
+  inverted = Bitop_CountBits( temp ^ 0xE20330E5 ) <
+             Bitop_CountBits( temp ^ 0x1DFCCF1A );
+  if( inverted ) temp = ~temp;
+  mtd->last_sync = temp;
 
-  for( j = 0; j < HARD_FRAME_LEN - 4; j++ )
-    decoded[4 + j] ^= prand[j % 255];
-
-  for( j = 0; j <= 3; j++ )
-  {
-    Ecc_Deinterleave( &(decoded[4]), ecc_buf, j, 4 );
-    mtd->r[j] = Ecc_Decode( ecc_buf, 0 );
-    Ecc_Interleave( ecc_buf, mtd->ecced_data, j, 4 );
-  }
+  //Derandomise (and flip back) while splitting up the four
+  //interleaved codewords, then decode them all in one batch
+  Ecc_Gather( &(decoded[4]), prand_frame[inverted], cw, mtd->ecced_data );
+  Ecc_Decode_Batch( cw, ECC_DEPTH, mtd->r, mtd->ecced_data );
 
   return (mtd->r[0] && mtd->r[1] && mtd->r[2] && mtd->r[3]);
 }
 
 /*****************************************************************************/
 
+/* Mtd_One_Frame()
+ *
+ * Advances the frame decoder by one step of its sync state machine:
+ * SEARCH soft correlates whole frames for the ASM, while CHECK, LOCK
+ * and FLYWHEEL feed the streaming Viterbi decoder and, once a whole
+ * frame is decoded, check its sync and error-correct it. A failed
+ * frame leads to FLYWHEEL, which keeps decoding at the predicted
+ * position. If the ASM is missing from the bit stream, only a small
+ * window around it is correlated (the IQ phase may have slipped),
+ * until FLYWHEEL_FRAMES frames in a row have failed. Returns true
+ * when a good frame is ready in ecced_data
+ */
 bool Mtd_One_Frame(mtd_rec_t *mtd, uint8_t *raw) {
-    uint8_t aligned[SOFT_FRAME_LEN];
-    bool result = false;
+    bool synced, result;
+    uint32_t want, lag;
+    int start, end, restart;
 
-    if (mtd->cpos == 0) {
-        Do_Next_Correlate(mtd, raw, aligned);
-        result = Try_Frame(mtd, aligned);
+    mtd->frame_out = false;
 
-        if (!result)
-            mtd->pos -= SOFT_FRAME_LEN;
+    if (mtd->sync_state == SYNC_SEARCH) {
+        Do_Full_Correlate(mtd, raw);
+        return false;
     }
 
-    if (!result) {
-        Do_Full_Correlate(mtd, raw, aligned);
-        result = Try_Frame(mtd, aligned);
+    //Decode the predicted frame and the sync window past its end
+    want = mtd->frame_bit + HARD_FRAME_BITS + SYNC_WINDOW;
+    if (!Do_Stream_Decode(mtd, raw, want))
+        return false;
+
+    synced = Find_Sync(mtd);
+
+    //Soft symbol position the frame was decoded from
+    lag = mtd->v.out_pos + (uint32_t)mtd->v.len - mtd->frame_bit;
+    mtd->prev_pos = mtd->pos - 2 * (int)(lag + VIT_STREAM_DELAY);
+
+    result = Try_Frame(mtd);
+    mtd->frame_bit += HARD_FRAME_BITS;
+    mtd->frame_out = synced || result;
+
+    if (result) {
+        Sync_Enter(mtd, SYNC_LOCK);
+        return true;
     }
 
-    return result;
+    mtd->sync_fails++;
+    if (synced) {
+        Sync_Enter(mtd, SYNC_FLYWHEEL);
+        return false;
+    }
+
+    //Probably a false correlation hit, search on just past it
+    if (mtd->sync_state == SYNC_CHECK) {
+        restart = mtd->prev_pos + 1;
+        mtd->pos = (restart > 0) ? restart : 0;
+        Sync_Enter(mtd, SYNC_SEARCH);
+        return false;
+    }
+
+    //Look for the ASM around the predicted position. The window is
+    //clipped at the start of the soft buffer, and skipped if that
+    //leaves too little of it to hold the ASM
+    start = mtd->prev_pos - SEARCH_WINDOW / 2;
+    end = mtd->prev_pos + SEARCH_WINDOW / 2;
+    if (start < 0)
+        start = 0;
+    if (end - start > PATTERN_SIZE) {
+        mtd->window_searches++;
+        if (Do_Correlate(mtd, raw, start, end - start))
+            return false;
+    }
+
+    if (mtd->sync_fails < FLYWHEEL_FRAMES) {
+        Sync_Enter(mtd, SYNC_FLYWHEEL);
+        return false;
+    }
+
+    mtd->pos = (end > 0) ? end : 0;
+    Sync_Enter(mtd, SYNC_SEARCH);
+
+    return false;
 }
 
 /*****************************************************************************/
@@ -32,6 +32,17 @@
 
 /*****************************************************************************/
 
+/* Frame sync states */
+enum {
+    SYNC_SEARCH = 0,    /* Soft correlating for the ASM */
+    SYNC_CHECK,         /* Decoding the first frame after a correlation hit */
+    SYNC_LOCK,          /* Frames decode at the predicted position */
+    SYNC_FLYWHEEL,      /* Riding out RS failures at the predicted position */
+    SYNC_STATES
+};
+
+/*****************************************************************************/
+
 /* Decoder MTD data */
 typedef struct mtd_rec_t {
     corr_rec_t c;
@@ -43,6 +54,18 @@ typedef struct mtd_rec_t {
     uint32_t word, cpos, corr, last_sync;
     int sig_q;
     bool r[4];
+
+    /* Frame sync state machine, frame_bit is the
+     * predicted ASM position in the decoded stream */
+    int sync_state, sync_fails;
+    uint32_t frame_bit;
+
+    /* Set when the last step decoded a frame at a synced position */
+    bool frame_out;
+
+    /* Sync metrics, entries into each state and searches done */
+    uint32_t sync_entries[SYNC_STATES];
+    uint32_t full_searches, window_searches;
 } mtd_rec_t;
 
 /*****************************************************************************/
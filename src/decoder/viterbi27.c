@@ -37,10 +37,10 @@
 
 /*****************************************************************************/
 
-static uint16_t Metric_Soft_Distance(
-        uint8_t hard,
-        uint8_t soft_y0,
-        uint8_t soft_y1);
+static inline void Metric_Soft_Distances(
+        viterbi27_rec_t *v,
+        int soft_y0,
+        int soft_y1);
 static void Pair_Lookup_Create(viterbi27_rec_t *v);
 static void Pair_Lookup_Fill_Distance(viterbi27_rec_t *v);
 static uint32_t History_Buffer_Search(viterbi27_rec_t *v, int search_every);
@@ -53,64 +53,37 @@ static void History_Buffer_Traceback(
         uint32_t min_traceback_length);
 static void History_Buffer_Process_Skip(viterbi27_rec_t *v, int skip);
 static void Error_Buffer_Swap(viterbi27_rec_t *v);
-static void Vit_Inner(viterbi27_rec_t *v, uint8_t *soft);
-static void Vit_Tail(viterbi27_rec_t *v, uint8_t *soft);
-static void Vit_Conv_Decode(
-        viterbi27_rec_t *v,
-        uint8_t *msg,
-        uint8_t *soft_encoded);
-static void Vit_Conv_Encode(
+static inline void Vit_Store_Hard(
         viterbi27_rec_t *v,
-        uint8_t *input,
-        uint8_t *output);
+        int soft_y0,
+        int soft_y1);
+static inline uint64_t Ring_Peek64(const uint8_t *ring, uint32_t bit);
+static inline uint32_t Vit_Encode_Word(uint64_t x, uint32_t poly);
+static void Vit_Step(viterbi27_rec_t *v, int soft_y0, int soft_y1);
 
 /*****************************************************************************/
 
-static uint16_t Metric_Soft_Distance(
-        uint8_t hard,
-        uint8_t soft_y0,
-        uint8_t soft_y1) {
-  const int mag = 255;
-  int soft_x0, soft_x1;
-  uint16_t result;
-
-  switch( hard & 0x03 )
-  {
-    case 0:
-      soft_x0 = mag;
-      soft_x1 = mag;
-      break;
-
-    case 1:
-      soft_x0 = -mag;
-      soft_x1 =  mag;
-      break;
-
-    case 2:
-      soft_x0 =  mag;
-      soft_x1 = -mag;
-      break;
-
-    case 3:
-      soft_x0 = -mag;
-      soft_x1 = -mag;
-      break;
-
-    default:
-      soft_x0 = 0;
-      soft_x1 = 0; //Dewarning
-  }
-
-  //Linear distance
-  result = (uint16_t)
-    ( abs((int8_t)soft_y0 - soft_x0) +
-      abs((int8_t)soft_y1 - soft_x1) );
+/* Metric_Soft_Distances()
+ *
+ * Computes the linear distances of a received soft symbol pair
+ * to each of the four possible encoder outputs. Hard symbols are
+ * at +/-255 and soft symbols within +/-128, so the absolute
+ * values never change sign and each distance reduces to a sum
+ * or difference of the two soft values (no lookup table needed)
+ */
+static inline void Metric_Soft_Distances(
+        viterbi27_rec_t *v,
+        int soft_y0,
+        int soft_y1) {
+  int sum, diff;
 
-  //Quadratic distance, not much better or worse.
-  //result = round(sqrt(sqr(shortint(soft_y0)-soft_x0)+
-  //sqr(shortint(soft_y1)-soft_x1)));
+  sum  = soft_y0 + soft_y1;
+  diff = soft_y0 - soft_y1;
 
-  return( result );
+  v->distances[0] = (uint16_t)( 2 * SOFT_MAX - sum  );
+  v->distances[1] = (uint16_t)( 2 * SOFT_MAX + diff );
+  v->distances[2] = (uint16_t)( 2 * SOFT_MAX - diff );
+  v->distances[3] = (uint16_t)( 2 * SOFT_MAX + sum  );
 }
 
 /*****************************************************************************/
@@ -198,15 +171,21 @@ static void History_Buffer_Renormalize(
 
 /*****************************************************************************/
 
+/* History_Buffer_Traceback()
+ *
+ * Traces the survivor path back from bestpath and writes the decoded
+ * bits straight into the output ring. Bits come out newest first, so
+ * bytes are assembled from the end of the run backwards and the first
+ * byte is merged with the bits already written by the previous run
+ */
 static void History_Buffer_Traceback(
         viterbi27_rec_t *v,
         uint32_t bestpath,
         uint32_t min_traceback_length) {
   int j;
-  uint32_t index, fetched_index, pathbit, prefetch_index, len;
-  uint8_t history;
+  uint32_t index, pathbit, pos, idx;
+  uint8_t byte;
 
-  fetched_index = 0;
   index = (uint32_t)(v->hist_index);
   for( j = 0; j < (int)min_traceback_length; j++ )
   {
@@ -214,38 +193,38 @@ static void History_Buffer_Traceback(
       index = MIN_TRACEBACK + TRACEBACK_LENGTH - 1;
     else index--;
 
-    history = v->history[index][bestpath];
-    if( history != 0 ) pathbit = HIGH_BIT;
-    else pathbit = 0;
-    bestpath = (bestpath | pathbit) >> 1;
+    pathbit  = (uint32_t)( v->history[index] >> bestpath ) & 1;
+    bestpath = (bestpath >> 1) | (pathbit << 5);
   }
 
-  prefetch_index = index;
-  if( prefetch_index == 0 )
-    prefetch_index = MIN_TRACEBACK + TRACEBACK_LENGTH - 1;
-  else prefetch_index--;
+  pos  = v->out_pos + (uint32_t)v->len - min_traceback_length;
+  v->out_pos = pos;
+  byte = 0;
+  for( j = (int)min_traceback_length; j < v->len; j++ )
+  {
+    if( index == 0 )
+      index = MIN_TRACEBACK + TRACEBACK_LENGTH - 1;
+    else index--;
+
+    pathbit  = (uint32_t)( v->history[index] >> bestpath ) & 1;
+    bestpath = (bestpath >> 1) | (pathbit << 5);
+
+    pos--;
+    byte |= (uint8_t)( pathbit << (7 - (pos & 7)) );
+    if( (pos & 7) == 0 )
+    {
+      v->out[(pos >> 3) & (VIT_RING_BITS / 8 - 1)] = byte;
+      byte = 0;
+    }
+  }
 
-  len = (uint32_t)(v->len);
-  for( j = (int)min_traceback_length; j < (int)len; j++ )
+  if( (pos & 7) != 0 )
   {
-    index = prefetch_index;
-    if( prefetch_index == 0 )
-      prefetch_index = MIN_TRACEBACK + TRACEBACK_LENGTH - 1;
-    else prefetch_index--;
-
-    history = v->history[index][bestpath];
-    if( history != 0 ) pathbit = HIGH_BIT;
-    else pathbit = 0;
-    bestpath = (bestpath | pathbit) >> 1;
-
-    if( pathbit != 0 ) v->fetched[fetched_index] = 1;
-    else v->fetched[fetched_index] = 0;
-    fetched_index++;
+    idx = (pos >> 3) & (VIT_RING_BITS / 8 - 1);
+    v->out[idx] = (uint8_t)( (v->out[idx] & (0xFF00 >> (pos & 7))) | byte );
   }
 
-  Bitop_WriteBitlistReversed(
-      &(v->bit_writer), v->fetched, (int)fetched_index );
-  v->len -= fetched_index;
+  v->len = (int)min_traceback_length;
 }
 
 /*****************************************************************************/
@@ -285,153 +264,120 @@ static void Error_Buffer_Swap(viterbi27_rec_t *v) {
 
 /*****************************************************************************/
 
-static void Vit_Inner(viterbi27_rec_t *v, uint8_t *soft) {
-  uint32_t highbase, low, high, base, offset, base_offset;
-  int i, j;
-  uint8_t *history;
-  uint32_t low_key, high_key, low_concat_dist, high_concat_dist;
-  uint32_t successor, low_plus_one, plus_one_successor;
-  uint16_t low_past_error, high_past_error, low_error, high_error, error;
-  uint16_t low_plus_one_error, high_plus_one_error, plus_one_error;
-  uint8_t history_mask, plus_one_history_mask;
+/* Vit_Store_Hard()
+ *
+ * Keeps the hard decisions (sign bits) of a received symbol pair,
+ * one bit ring per polynomial, indexed by trellis step
+ */
+static inline void Vit_Store_Hard(
+        viterbi27_rec_t *v,
+        int soft_y0,
+        int soft_y1) {
+  uint32_t step, idx;
+  uint8_t mask;
 
-  for( i = 0; i <= 5; i++ )
+  step = v->out_pos + (uint32_t)v->len;
+  idx  = (step >> 3) & (VIT_RING_BITS / 8 - 1);
+  mask = (uint8_t)( 0x80 >> (step & 7) );
+
+  if( (step & 7) == 0 )
   {
-    for( j = 0; j < (1 << (i + 1)); j++ )
-    {
-      int idx = (soft[i * 2 + 1] << 8) + soft[i * 2];
-      v->write_errors[j] =
-        v->dist_table[v->table[j]][idx] + v->read_errors[j >> 1];
-    }
-    Error_Buffer_Swap( v );
+    v->hard_a[idx] = 0;
+    v->hard_b[idx] = 0;
   }
 
-  for( i = 6; i <= FRAME_BITS - 7; i++ )
-  {
-    for( j = 0; j <= 3; j++ )
-    {
-      int idx = (soft[i * 2 + 1] << 8) + soft[i * 2];
-      v->distances[j] = v->dist_table[j][idx];
-    }
-    history = &(v->history[v->hist_index][0]);
+  if( soft_y0 < 0 ) v->hard_a[idx] |= mask;
+  if( soft_y1 < 0 ) v->hard_b[idx] |= mask;
+}
 
-    Pair_Lookup_Fill_Distance( v );
+/*****************************************************************************/
 
-    highbase = HIGH_BIT >> 1;
-    low = 0;
-    high = HIGH_BIT;
-    base = 0;
-    while( high < NUM_ITER )
-    {
-      offset = 0;
-      base_offset = 0;
-      while( base_offset < 4 )
-      {
-        low_key  = v->pair_keys[base + base_offset];
-        high_key = v->pair_keys[highbase + base + base_offset];
-
-        low_concat_dist  = v->pair_distances[low_key];
-        high_concat_dist = v->pair_distances[high_key];
-
-        low_past_error  = v->read_errors[base + base_offset];
-        high_past_error = v->read_errors[highbase + base + base_offset];
-
-        low_error  = (low_concat_dist  & 0xFFFF) + low_past_error;
-        high_error = (high_concat_dist & 0xFFFF) + high_past_error;
-
-        successor = low + offset;
-        if( low_error <= high_error )
-        {
-          error = low_error;
-          history_mask = 0;
-        }
-        else
-        {
-          error = high_error;
-          history_mask = 1;
-        }
-        v->write_errors[successor] = error;
-        history[successor] = history_mask;
-
-        low_plus_one = low + offset + 1;
-
-        low_plus_one_error  = (low_concat_dist  >> 16) + low_past_error;
-        high_plus_one_error = (high_concat_dist >> 16) + high_past_error;
-
-        plus_one_successor = low_plus_one;
-        if( low_plus_one_error <= high_plus_one_error )
-        {
-          plus_one_error = low_plus_one_error;
-          plus_one_history_mask = 0;
-        }
-        else
-        {
-          plus_one_error = high_plus_one_error;
-          plus_one_history_mask = 1;
-        }
-        v->write_errors[plus_one_successor] = plus_one_error;
-        history[plus_one_successor] = plus_one_history_mask;
-
-        offset += 2;
-        base_offset++;
-      }
+/* Ring_Peek64()
+ *
+ * Returns the 64 bits at position bit of a bit ring, MSB first
+ */
+static inline uint64_t Ring_Peek64(const uint8_t *ring, uint32_t bit) {
+  int i;
+  uint32_t idx, shift;
+  uint64_t result;
 
-      low  += 8;
-      high += 8;
-      base += 4;
-    }
+  idx   = bit >> 3;
+  shift = bit & 7;
+  result = 0;
+  for( i = 0; i < 8; i++ )
+    result = (result << 8) | ring[(idx + (uint32_t)i) & (VIT_RING_BITS / 8 - 1)];
 
-    History_Buffer_Process_Skip( v, 1 );
-    Error_Buffer_Swap( v );
-  }
+  if( shift != 0 )
+    result = (result << shift) |
+      (ring[(idx + 8) & (VIT_RING_BITS / 8 - 1)] >> (8 - shift));
+
+  return( result );
 }
 
 /*****************************************************************************/
 
-static void Vit_Tail(viterbi27_rec_t *v, uint8_t *soft) {
-  int i, j;
-  uint8_t *history;
-  uint32_t skip, base_skip, highbase, low, high;
-  uint32_t base, low_output, high_output;
-  uint16_t low_dist, high_dist, low_past_error;
-  uint16_t high_past_error, low_error, high_error;
-  uint32_t successor;
-  uint16_t error;
-  uint8_t history_mask;
+/* Vit_Encode_Word()
+ *
+ * Convolutionally encodes the 32 bits in the low end of x with one
+ * polynomial, the 6 bits above them being the preceding encoder state.
+ * Each tap of the polynomial is just one shift of the whole word
+ */
+static inline uint32_t Vit_Encode_Word(uint64_t x, uint32_t poly) {
+  int k;
+  uint64_t result = 0;
 
+  for( k = 0; k <= VIT_STREAM_DELAY; k++ )
+    if( (poly >> k) & 1 ) result ^= x >> k;
 
-  for( i = FRAME_BITS - 6; i < FRAME_BITS; i++ )
-  {
-    for( j = 0; j <= 3; j++ )
-    {
-      int idx = (soft[i * 2 + 1] << 8) + soft[i * 2];
-      v->distances[j] = v->dist_table[j][idx];
-    }
-    history = &(v->history[v->hist_index][0]);
+  return( (uint32_t)result );
+}
 
-    skip = 1 << ( 7 - (FRAME_BITS - i) );
-    base_skip = skip >> 1;
+/*****************************************************************************/
 
-    highbase = HIGH_BIT >> 1;
-    low = 0;
-    high = HIGH_BIT;
-    base = 0;
-    while( high < NUM_ITER )
+/* Vit_Step()
+ *
+ * Runs one trellis step (add-compare-select over all
+ * live states) for a soft symbol pair
+ */
+static void Vit_Step(viterbi27_rec_t *v, int soft_y0, int soft_y1) {
+  uint32_t highbase, low, high, base, offset, base_offset;
+  uint64_t history;
+  uint32_t low_key, high_key, low_concat_dist, high_concat_dist;
+  uint32_t successor, low_plus_one, plus_one_successor;
+  uint16_t low_past_error, high_past_error, low_error, high_error, error;
+  uint16_t low_plus_one_error, high_plus_one_error, plus_one_error;
+  uint8_t history_mask, plus_one_history_mask;
+
+  Metric_Soft_Distances( v, soft_y0, soft_y1 );
+  Vit_Store_Hard( v, soft_y0, soft_y1 );
+  history = 0;
+
+  Pair_Lookup_Fill_Distance( v );
+
+  highbase = HIGH_BIT >> 1;
+  low = 0;
+  high = HIGH_BIT;
+  base = 0;
+  while( high < NUM_ITER )
+  {
+    offset = 0;
+    base_offset = 0;
+    while( base_offset < 4 )
     {
-      low_output  = v->table[low];
-      high_output = v->table[high];
+      low_key  = v->pair_keys[base + base_offset];
+      high_key = v->pair_keys[highbase + base + base_offset];
 
-      low_dist  = v->distances[low_output];
-      high_dist = v->distances[high_output];
+      low_concat_dist  = v->pair_distances[low_key];
+      high_concat_dist = v->pair_distances[high_key];
 
-      low_past_error  = v->read_errors[base];
-      high_past_error = v->read_errors[highbase + base];
+      low_past_error  = v->read_errors[base + base_offset];
+      high_past_error = v->read_errors[highbase + base + base_offset];
 
-      low_error  = low_dist  + low_past_error;
-      high_error = high_dist + high_past_error;
+      low_error  = (low_concat_dist  & 0xFFFF) + low_past_error;
+      high_error = (high_concat_dist & 0xFFFF) + high_past_error;
 
-      successor = low;
-      if( low_error < high_error  )
+      successor = low + offset;
+      if( low_error <= high_error )
       {
         error = low_error;
         history_mask = 0;
@@ -442,25 +388,50 @@ static void Vit_Tail(viterbi27_rec_t *v, uint8_t *soft) {
         history_mask = 1;
       }
       v->write_errors[successor] = error;
-      history[successor] = history_mask;
+      history |= (uint64_t)history_mask << successor;
+
+      low_plus_one = low + offset + 1;
+
+      low_plus_one_error  = (low_concat_dist  >> 16) + low_past_error;
+      high_plus_one_error = (high_concat_dist >> 16) + high_past_error;
+
+      plus_one_successor = low_plus_one;
+      if( low_plus_one_error <= high_plus_one_error )
+      {
+        plus_one_error = low_plus_one_error;
+        plus_one_history_mask = 0;
+      }
+      else
+      {
+        plus_one_error = high_plus_one_error;
+        plus_one_history_mask = 1;
+      }
+      v->write_errors[plus_one_successor] = plus_one_error;
+      history |= (uint64_t)plus_one_history_mask << plus_one_successor;
 
-      low += skip;
-      high += skip;
-      base += base_skip;
+      offset += 2;
+      base_offset++;
     }
 
-    History_Buffer_Process_Skip( v, (int)skip );
-    Error_Buffer_Swap( v );
+    low  += 8;
+    high += 8;
+    base += 4;
   }
+  v->history[v->hist_index] = history;
+
+  History_Buffer_Process_Skip( v, 1 );
+  Error_Buffer_Swap( v );
 }
 
 /*****************************************************************************/
 
-static void Vit_Conv_Decode(
-        viterbi27_rec_t *v,
-        uint8_t *msg,
-        uint8_t *soft_encoded) {
-  Bitop_WriterCreate( &(v->bit_writer), msg, (FRAME_BITS * 2) / 8 );
+/* Vit_Stream_Reset()
+ *
+ * Restarts the continuous decoder with all path metrics equal,
+ * to be called when a new symbol stream alignment is found
+ */
+void Vit_Stream_Reset(viterbi27_rec_t *v) {
+  v->out_pos = 0;
 
   //history_buffer
   v->len = 0;
@@ -473,70 +444,119 @@ static void Vit_Conv_Decode(
   v->err_index = 0;
   v->read_errors  = &(v->errors[0][0]);
   v->write_errors = &(v->errors[1][0]);
-
-  Vit_Inner( v, soft_encoded );
-  Vit_Tail(  v, soft_encoded );
-  History_Buffer_Traceback( v, 0, 0 );
 }
 
 /*****************************************************************************/
 
-static void Vit_Conv_Encode(
+/* Vit_Stream_Decode()
+ *
+ * Feeds soft symbol pairs from soft into the decoder until either
+ * len symbols are used up or the decoded bit count reaches want.
+ * The IQ ambiguity found by the correlator (shift) is undone pair
+ * by pair on the way in, so soft can point straight into the
+ * demodulator's buffer. Path metrics and survivors carry over
+ * between calls, so there is no trellis warm-up or tail per frame.
+ * Returns the symbols consumed
+ */
+int Vit_Stream_Decode(
         viterbi27_rec_t *v,
-        uint8_t *input,
-        uint8_t *output) {
-  uint32_t sh;
-  int i;
-  bit_io_rec_t b;
-
-  b.p = input;
-  b.pos = 0;
+        const uint8_t *soft,
+        int len,
+        int shift,
+        uint32_t want) {
+  int i, y0, y1;
 
-  sh = 0;
-  for( i = 0; i < FRAME_BITS; i++ )
+  for( i = 0; i + 1 < len; i += 2 )
   {
-    sh = ( (sh << 1) | Bitop_FetchNBits(&b, 1) ) & 0x7F;
+    if( (int32_t)(v->out_pos - want) >= 0 ) break;
 
-    if( (v->table[sh] & 1) != 0 ) output[i * 2 + 0] = 0;
-    else output[i * 2 + 0] = 255;
-
-    if( (v->table[sh] & 2) != 0 ) output[i * 2 + 1] = 0;
-    else output[i * 2 + 1] = 255;
+    y0 = (int8_t)soft[i];
+    y1 = (int8_t)soft[i + 1];
+    Fix_Pair( shift, &y0, &y1 );
+    Vit_Step( v, y0, y1 );
   }
+
+  return( i );
 }
 
 /*****************************************************************************/
 
-void Vit_Decode(viterbi27_rec_t *v, uint8_t *input, uint8_t *output) {
+/* Vit_Stream_Read()
+ *
+ * Copies len decoded bytes starting at stream bit position bit
+ */
+void Vit_Stream_Read(
+        const viterbi27_rec_t *v,
+        uint32_t bit,
+        uint8_t *output,
+        int len) {
   int i;
-  uint8_t corrected[FRAME_BITS * 2];
+  uint32_t idx, shift;
+
+  idx   = bit >> 3;
+  shift = bit & 7;
+  for( i = 0; i < len; i++ )
+  {
+    output[i] = v->out[(idx + (uint32_t)i) & (VIT_RING_BITS / 8 - 1)];
+    if( shift != 0 )
+      output[i] = (uint8_t)( (output[i] << shift) |
+          (v->out[(idx + (uint32_t)i + 1) & (VIT_RING_BITS / 8 - 1)] >> (8 - shift)) );
+  }
+}
 
-  Vit_Conv_Decode( v, output, input );
+/*****************************************************************************/
+
+/* Vit_Stream_Peek32()
+ *
+ * Returns the 32 decoded bits at stream bit position bit, MSB first
+ */
+uint32_t Vit_Stream_Peek32(const viterbi27_rec_t *v, uint32_t bit) {
+  uint8_t b[4];
+
+  Vit_Stream_Read( v, bit, b, 4 );
+
+  return(
+      ((uint32_t)b[0] << 24) |
+      ((uint32_t)b[1] << 16) |
+      ((uint32_t)b[2] <<  8) |
+      (uint32_t)b[3] );
+}
+
+/*****************************************************************************/
+
+/* Vit_Stream_BER()
+ *
+ * Gauges the error level of nbits (a multiple of 32) decoded bits at
+ * stream position bit by re-encoding them 32 at a time and counting
+ * the differences to the hard decisions of the received symbol pairs
+ */
+void Vit_Stream_BER(viterbi27_rec_t *v, uint32_t bit, int nbits) {
+  int i;
+  uint32_t step;
+  uint64_t x;
 
-  //Gauge error level
-  Vit_Conv_Encode( v, output, corrected );
   v->BER = 0;
-  for( i = 0; i < FRAME_BITS * 2; i++ )
-    v->BER += Hard_Correlate( input[i], corrected[i] ^ 0xFF );
+  for( i = 0; i < nbits; i += 32 )
+  {
+    //Decoded bits from 6 before the word, then the step they came from
+    step = bit + (uint32_t)i - VIT_STREAM_DELAY;
+    x = Ring_Peek64( v->out, step ) >> (32 - VIT_STREAM_DELAY);
+
+    v->BER += Bitop_CountBits( Vit_Encode_Word(x, VITERBI27_POLYA) ^
+        (uint32_t)(Ring_Peek64(v->hard_a, step) >> 32) );
+    v->BER += Bitop_CountBits( Vit_Encode_Word(x, VITERBI27_POLYB) ^
+        (uint32_t)(Ring_Peek64(v->hard_b, step) >> 32) );
+  }
 }
 
 /*****************************************************************************/
 
 void Mk_Viterbi27(viterbi27_rec_t *v) {
-  int i, j;
+  int i;
 
   v->BER = 0;
   v->pair_distances = NULL; // My addition, for alloc's
 
-  // Metric lookup table
-  for( i = 0; i <= 3; i++ )
-    for( j = 0; j <= 65535; j++ )
-    {
-      v->dist_table[i][j] =
-        Metric_Soft_Distance(
-            (uint8_t)i, (uint8_t)(j & 0xFF), (uint8_t)(j >> 8) );
-    }
-
   // Polynomial table
   for( i = 0; i <= 127; i++ )
   {
@@ -548,4 +568,5 @@ void Mk_Viterbi27(viterbi27_rec_t *v) {
   }
 
   Pair_Lookup_Create( v );
+  Vit_Stream_Reset( v );
 }
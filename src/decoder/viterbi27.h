@@ -31,17 +31,31 @@
 #define MIN_TRACEBACK       35      // 5*7
 #define TRACEBACK_LENGTH    105     // 15*7
 
+/* Decoded bits and received symbol pairs kept by the
+ * streaming decoder, a power of 2 holding two frames */
+#define VIT_RING_BITS       16384
+
+/* Decisions lag the encoder input by K - 1 bits, so the first bits
+ * out of a restarted stream are the encoder state before the first
+ * symbol pair and data fed from the start shows up at this position */
+#define VIT_STREAM_DELAY    6
+
 /*****************************************************************************/
 
 /* Viterbi decoder data */
 typedef struct viterbi27_rec_t {
   int BER;
 
-  uint16_t dist_table[4][65536];
   uint8_t  table[NUM_STATES];
   uint16_t distances[4];
 
-  bit_io_rec_t bit_writer;
+  //Decoded bit ring, out_pos counts bits decoded since the last reset
+  uint8_t  out[VIT_RING_BITS / 8];
+  uint32_t out_pos;
+
+  //Hard decisions of the received symbol pairs, one ring per polynomial
+  uint8_t  hard_a[VIT_RING_BITS / 8];
+  uint8_t  hard_b[VIT_RING_BITS / 8];
 
   //pair_lookup
   uint32_t pair_keys[64];      //1 shl (order-1)
@@ -50,8 +64,8 @@ typedef struct viterbi27_rec_t {
   uint32_t pair_outputs[16];   //1 shl (2*rate)
   uint32_t pair_outputs_len;
 
-  uint8_t history[MIN_TRACEBACK + TRACEBACK_LENGTH][NUM_STATES];
-  uint8_t fetched[MIN_TRACEBACK + TRACEBACK_LENGTH];
+  //Survivor decisions, one bit per live state (NUM_STATES / 2) per step
+  uint64_t history[MIN_TRACEBACK + TRACEBACK_LENGTH];
   int hist_index, len, renormalize_counter;
 
   int err_index;
@@ -67,7 +81,20 @@ static inline double Vit_Get_Percent_BER(const viterbi27_rec_t *v) {
 
 /*****************************************************************************/
 
-void Vit_Decode(viterbi27_rec_t *v, uint8_t *input, uint8_t *output);
+void Vit_Stream_Reset(viterbi27_rec_t *v);
+int Vit_Stream_Decode(
+        viterbi27_rec_t *v,
+        const uint8_t *soft,
+        int len,
+        int shift,
+        uint32_t want);
+void Vit_Stream_Read(
+        const viterbi27_rec_t *v,
+        uint32_t bit,
+        uint8_t *output,
+        int len);
+uint32_t Vit_Stream_Peek32(const viterbi27_rec_t *v, uint32_t bit);
+void Vit_Stream_BER(viterbi27_rec_t *v, uint32_t bit, int nbits);
 void Mk_Viterbi27(viterbi27_rec_t *v);
 
 /*****************************************************************************/
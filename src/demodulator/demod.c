@@ -18,6 +18,7 @@
 
 #include "../common/common.h"
 #include "../common/shared.h"
+#include "../decoder/cadu_out.h"
 #include "../decoder/medet.h"
 #include "../decoder/met_jpg.h"
 #include "../decoder/met_to_data.h"
@@ -562,6 +563,7 @@ void Demodulator_Run(void) {
   }
 
   Mj_Dump_Image();
+  Cadu_Out_Close();
   Cleanup();
   free_ptr( (void **)&out_buffer );
   Print_Message( "Receiving and Decoding Ended", INFO_MESG );
@@ -0,0 +1,139 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#include "image_store.h"
+
+#include "../common/common.h"
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*****************************************************************************/
+
+#define STRIP_SIZE  ((size_t)STRIP_LINES * METEOR_IMAGE_WIDTH)
+
+/*****************************************************************************/
+
+static uint8_t *Strip_Alloc(void);
+
+/*****************************************************************************/
+
+/* Strips released by images of past passes, kept for the next ones */
+static uint8_t **strip_pool = NULL;
+static uint32_t pool_cnt = 0, pool_max = 0;
+
+/*****************************************************************************/
+
+/* Strip_Alloc()
+ *
+ * Returns a cleared strip, from the pool if it has any
+ */
+static uint8_t *Strip_Alloc(void) {
+  uint8_t *strip;
+
+  if( pool_cnt == 0 )
+  {
+    mem_alloc( (void **)&strip, STRIP_SIZE );
+    return( strip );
+  }
+
+  strip = strip_pool[--pool_cnt];
+  memset( strip, 0, STRIP_SIZE );
+
+  return( strip );
+}
+
+/*****************************************************************************/
+
+/* Store_Grow()
+ *
+ * Grows an image to height lines. New lines are cleared and
+ * lines already there don't move, so pointers to them stay good
+ */
+void Store_Grow(image_store_t *store, uint32_t height) {
+  uint32_t need;
+
+  if( height <= store->height ) return;
+
+  need = ( height + STRIP_LINES - 1 ) / STRIP_LINES;
+  if( need > store->strip_max )
+  {
+    //The strip array grows geometrically, strips are never copied
+    store->strip_max = store->strip_max ? store->strip_max * 2 : 16;
+    if( store->strip_max < need ) store->strip_max = need;
+    mem_realloc( (void **)&store->strip,
+        store->strip_max * sizeof(uint8_t *) );
+  }
+
+  while( store->strips < need )
+    store->strip[store->strips++] = Strip_Alloc();
+
+  store->height = height;
+}
+
+/*****************************************************************************/
+
+/* Store_Line()
+ *
+ * Returns line y of an image. The lines of an MCU row
+ * follow each other, METEOR_IMAGE_WIDTH bytes apart
+ */
+uint8_t *Store_Line(const image_store_t *store, uint32_t y) {
+  return( &store->strip[y / STRIP_LINES]
+      [(size_t)(y % STRIP_LINES) * METEOR_IMAGE_WIDTH] );
+}
+
+/*****************************************************************************/
+
+/* Store_Copy()
+ *
+ * Copies the first height lines of an image into
+ * the contiguous buffer at image
+ */
+void Store_Copy(const image_store_t *store, uint8_t *image, uint32_t height) {
+  uint32_t idx, lines;
+
+  for( idx = 0; height > 0; idx++ )
+  {
+    lines = height < STRIP_LINES ? height : STRIP_LINES;
+    memcpy( image, store->strip[idx], (size_t)lines * METEOR_IMAGE_WIDTH );
+    image  += (size_t)lines * METEOR_IMAGE_WIDTH;
+    height -= lines;
+  }
+}
+
+/*****************************************************************************/
+
+/* Store_Release()
+ *
+ * Empties an image, keeping its strips in the pool for later images
+ */
+void Store_Release(image_store_t *store) {
+  if( pool_cnt + store->strips > pool_max )
+  {
+    pool_max = pool_cnt + store->strips;
+    mem_realloc( (void **)&strip_pool, pool_max * sizeof(uint8_t *) );
+  }
+
+  while( store->strips > 0 )
+    strip_pool[pool_cnt++] = store->strip[--store->strips];
+
+  free_ptr( (void **)&store->strip );
+  store->strip_max = 0;
+  store->height = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#ifndef MLRPT_IMAGE_STORE_H
+#define MLRPT_IMAGE_STORE_H
+
+/*****************************************************************************/
+
+#include <stdint.h>
+
+/*****************************************************************************/
+
+/* Image lines in a strip, a whole number of MCU rows */
+#define STRIP_LINES 128
+
+/*****************************************************************************/
+
+/* An image of METEOR_IMAGE_WIDTH pixel lines, kept in strips of
+ * STRIP_LINES lines that stay put as the image grows
+ */
+typedef struct image_store_t {
+    uint8_t **strip;
+    uint32_t strips;    /* Strips in use */
+    uint32_t strip_max; /* Length of the strip array */
+    uint32_t height;    /* Lines in the image, 0 if unused */
+} image_store_t;
+
+/*****************************************************************************/
+
+void Store_Grow(image_store_t *store, uint32_t height);
+uint8_t *Store_Line(const image_store_t *store, uint32_t y);
+void Store_Copy(const image_store_t *store, uint8_t *image, uint32_t height);
+void Store_Release(image_store_t *store);
+
+/*****************************************************************************/
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#include "jpeg_coefs.h"
+
+#include "../common/common.h"
+#include "image_store.h"
+#include "utils.h"
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+/*****************************************************************************/
+
+/* Range of DC and AC coefficients baseline JPEG can code */
+#define DC_MIN  -1024
+#define DC_MAX  1023
+#define AC_MAX  1023
+
+/*****************************************************************************/
+
+/* libjpeg error handler, returning to Save_Image_Coefs() */
+typedef struct jpeg_error_t {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} jpeg_error_t;
+
+/*****************************************************************************/
+
+static void Jpeg_Error_Exit(j_common_ptr cinfo);
+static JCOEF Requantise(int val, int q, int min, int max, uint32_t *clip);
+static uint32_t Requantise_Row(
+        JBLOCKROW row,
+        const int16_t *blk,
+        const uint16_t *qtable,
+        bool invert);
+
+/*****************************************************************************/
+
+static void Jpeg_Error_Exit(j_common_ptr cinfo) {
+  jpeg_error_t *err = (jpeg_error_t *)cinfo->err;
+  char mesg[JMSG_LENGTH_MAX];
+
+  (*cinfo->err->format_message)( cinfo, mesg );
+  Print_Message( mesg, ERROR_MESG );
+  longjmp( err->jump, 1 );
+}
+
+/*****************************************************************************/
+
+/* Requantise()
+ *
+ * Divides a dequantised coefficient by q, to the nearest integer,
+ * clipping it to min--max and counting clips in clip
+ */
+static JCOEF Requantise(int val, int q, int min, int max, uint32_t *clip) {
+  val = ( val >= 0 ) ? ( val + q / 2 ) / q : -( (q / 2 - val) / q );
+
+  if( (val > max) || (val < min) )
+  {
+    (*clip)++;
+    val = iClamp( val, min, max );
+  }
+
+  return( (JCOEF)val );
+}
+
+/*****************************************************************************/
+
+/* Requantise_Row()
+ *
+ * Requantises an MCU row of stored coefficients at blk into row,
+ * made negative if invert is set. Returns the number clipped
+ */
+static uint32_t Requantise_Row(
+        JBLOCKROW row,
+        const int16_t *blk,
+        const uint16_t *qtable,
+        bool invert) {
+  uint32_t bx, clip = 0, dummy;
+  int i, val;
+
+  for( bx = 0; bx < METEOR_IMAGE_WIDTH / DCTSIZE; bx++, blk += DCTSIZE2 )
+  {
+    //Blocks never received are black, inverted channel or not
+    if( blk[0] == 0 )
+    {
+      memset( row[bx], 0, sizeof(JBLOCK) );
+      row[bx][0] = Requantise( DC_MIN, qtable[0], DC_MIN, DC_MAX, &dummy );
+      continue;
+    }
+
+    //A sample shift of -1 is a DC shift of -8
+    val = blk[0] - COEF_DC_BIAS;
+    if( invert ) val = -val - 8;
+    row[bx][0] = Requantise( val, qtable[0], DC_MIN, DC_MAX, &clip );
+
+    for( i = 1; i < DCTSIZE2; i++ )
+      row[bx][i] = Requantise(
+          invert ? -blk[i] : blk[i], qtable[i], -AC_MAX, AC_MAX, &clip );
+  }
+
+  return( clip );
+}
+
+/*****************************************************************************/
+
+/* Save_Image_Coefs()
+ *
+ * Writes a grayscale baseline JPEG of height lines straight from
+ * the dequantised DCT coefficients in coefs, quantised with qtable
+ * (natural order), so that no IDCT and FDCT are done. If every
+ * coefficient is a multiple of its qtable entry the file holds
+ * exactly the coefficients sent. With invert the image is made
+ * negative in the DCT domain, like the palette inversion of APIDs,
+ * except for blocks never received, which stay black
+ */
+void Save_Image_Coefs(
+        const char *file_name,
+        const image_store_t *coefs,
+        uint32_t height,
+        const uint16_t *qtable,
+        bool invert) {
+  struct jpeg_compress_struct cinfo;
+  jpeg_error_t jerr;
+  jvirt_barray_ptr coef_arrays[1];
+  JBLOCKARRAY row;
+  volatile uint32_t clip = 0;
+  uint32_t by;
+  int i;
+  FILE *fp;
+  char mesg[MESG_SIZE];
+
+  snprintf( mesg, sizeof(mesg), "Saving Image: %s", file_name );
+  Print_Message( mesg, INFO_MESG );
+  if( !Open_File(&fp, file_name, "wb") ) return;
+
+  cinfo.err = jpeg_std_error( &jerr.mgr );
+  jerr.mgr.error_exit = Jpeg_Error_Exit;
+  if( setjmp(jerr.jump) )
+  {
+    jpeg_destroy_compress( &cinfo );
+    fclose( fp );
+    snprintf( mesg, sizeof(mesg), "Failed saving image: %s", file_name );
+    Print_Message( mesg, ERROR_MESG );
+    return;
+  }
+
+  jpeg_create_compress( &cinfo );
+  jpeg_stdio_dest( &cinfo, fp );
+
+  cinfo.image_width      = METEOR_IMAGE_WIDTH;
+  cinfo.image_height     = height;
+  cinfo.input_components = 1;
+  cinfo.in_color_space   = JCS_GRAYSCALE;
+  jpeg_set_defaults( &cinfo );
+
+  //Huffman tables made for the data, as coefficients may be large
+  cinfo.optimize_coding = TRUE;
+  for( i = 0; i < DCTSIZE2; i++ )
+    cinfo.quant_tbl_ptrs[0]->quantval[i] = qtable[i];
+
+  coef_arrays[0] = (*cinfo.mem->request_virt_barray)(
+      (j_common_ptr)&cinfo, JPOOL_IMAGE, TRUE,
+      METEOR_IMAGE_WIDTH / DCTSIZE, height / DCTSIZE, 1 );
+  jpeg_write_coefficients( &cinfo, coef_arrays );
+
+  for( by = 0; by < height / DCTSIZE; by++ )
+  {
+    row = (*cinfo.mem->access_virt_barray)(
+        (j_common_ptr)&cinfo, coef_arrays[0], by, 1, TRUE );
+    clip += Requantise_Row( row[0],
+        (const int16_t *)Store_Line(coefs, by * COEF_ROW_LINES),
+        qtable, invert );
+  }
+
+  jpeg_finish_compress( &cinfo );
+  jpeg_destroy_compress( &cinfo );
+  fclose( fp );
+
+  if( clip > 0 )
+  {
+    snprintf( mesg, sizeof(mesg),
+        "%u DCT coefficients clipped in %s", clip, file_name );
+    Print_Message( mesg, ERROR_MESG );
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#ifndef MLRPT_JPEG_COEFS_H
+#define MLRPT_JPEG_COEFS_H
+
+/*****************************************************************************/
+
+#include "image_store.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*****************************************************************************/
+
+/* Store lines holding the coefficients of an MCU row, 196 blocks
+ * of 64 dequantised coefficients in natural order
+ */
+#define COEF_ROW_LINES  16
+
+/* Added to the stored DC coefficients, which are kept above 0, so
+ * that a stored DC of 0 marks a block never received. These come
+ * out black like in the images, even on inverted channels
+ */
+#define COEF_DC_BIAS    2048
+
+/*****************************************************************************/
+
+void Save_Image_Coefs(
+        const char *file_name,
+        const image_store_t *coefs,
+        uint32_t height,
+        const uint16_t *qtable,
+        bool invert);
+
+/*****************************************************************************/
+
+#endif
@@ -0,0 +1,313 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#include "live_image.h"
+
+#include "../common/common.h"
+#include "../common/shared.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*****************************************************************************/
+
+/* MCU rows waiting to be written, bounds the memory used */
+#define LIVE_QUEUE_LEN  64
+
+/* Bytes of an MCU row of one channel */
+#define LIVE_ROW_SIZE   ((size_t)LIVE_ROW_LINES * METEOR_IMAGE_WIDTH)
+
+/* Width of the header's height field, so that it can be rewritten */
+#define HEIGHT_FIELD    10
+
+/*****************************************************************************/
+
+static void *Live_Writer(void *arg);
+static void Live_Open_Files(void);
+static void Live_Write_Row(const uint8_t *row);
+
+/*****************************************************************************/
+
+/* Ring of MCU rows of all channels, copied for the writer thread */
+static uint8_t *live_queue = NULL;
+static int queue_head = 0;
+static int queue_cnt  = 0;
+static bool live_stop = false;
+static bool live_active = false;
+
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t live_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t live_freed  = PTHREAD_COND_INITIALIZER;
+static pthread_t live_thread;
+
+/* Channel image file names, made by Live_Open() */
+static char *live_name[CHANNEL_IMAGE_NUM] = { NULL };
+
+/* Channel image files, used by the writer thread only */
+static FILE *live_fp[CHANNEL_IMAGE_NUM];
+static long height_pos[CHANNEL_IMAGE_NUM];
+static uint32_t live_lines;
+
+/* Channel images written whole, set by the writer thread as it ends */
+static bool live_saved[CHANNEL_IMAGE_NUM];
+
+/*****************************************************************************/
+
+/* Live_Open_Files()
+ *
+ * Creates the raw channel image files and writes their headers,
+ * with a blank height field to be filled in as rows are added
+ */
+static void Live_Open_Files(void) {
+  char mesg[MESG_SIZE];
+  uint32_t idx;
+
+  for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+  {
+    snprintf( mesg, MESG_SIZE, "Saving Image: %s", live_name[idx] );
+    Print_Message( mesg, INFO_MESG );
+    if( !Open_File(&live_fp[idx], live_name[idx], "w") ) continue;
+
+    if( (fprintf(live_fp[idx], "P5\n# Created by mlrpt\n%u ",
+            METEOR_IMAGE_WIDTH) < 0) ||
+        ((height_pos[idx] = ftell(live_fp[idx])) < 0) ||
+        (fprintf(live_fp[idx], "%*u\n255\n", HEIGHT_FIELD, 0) < 0) )
+    {
+      perror( "mlrpt: Error writing image to file" );
+      Print_Message( "Error writing image to file", ERROR_MESG );
+      fclose( live_fp[idx] );
+      live_fp[idx] = NULL;
+    }
+  }
+}
+
+/*****************************************************************************/
+
+/* Live_Write_Row()
+ *
+ * Appends an MCU row of each channel to its file and brings the
+ * height in the header up to date, so that the file is a whole
+ * image even if mlrpt doesn't get to close it
+ */
+static void Live_Write_Row(const uint8_t *row) {
+  uint32_t idx;
+  FILE *fp;
+
+  live_lines += LIVE_ROW_LINES;
+
+  for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+  {
+    fp = live_fp[idx];
+    if( fp == NULL ) continue;
+
+    if( (fwrite(&row[idx * LIVE_ROW_SIZE], 1, LIVE_ROW_SIZE, fp) !=
+          LIVE_ROW_SIZE) ||
+        (fseek(fp, height_pos[idx], SEEK_SET) != 0) ||
+        (fprintf(fp, "%*u", HEIGHT_FIELD, live_lines) < 0) ||
+        (fseek(fp, 0, SEEK_END) != 0) ||
+        (fflush(fp) != 0) )
+    {
+      perror( "mlrpt: Error writing image to file" );
+      Print_Message( "Error writing image to file", ERROR_MESG );
+      fclose( fp );
+      live_fp[idx] = NULL;
+    }
+  }
+}
+
+/*****************************************************************************/
+
+/* Live_Writer()
+ *
+ * File writing thread, writes out the queued rows until
+ * told to stop and there are none left
+ */
+static void *Live_Writer(void *arg) {
+  bool opened = false;
+  uint32_t idx;
+  uint8_t *row;
+
+  (void)arg;
+
+  live_lines = 0;
+  pthread_mutex_lock( &live_lock );
+  while( true )
+  {
+    while( (queue_cnt == 0) && !live_stop )
+      pthread_cond_wait( &live_filled, &live_lock );
+    if( queue_cnt == 0 ) break;
+
+    //The row's slot stays taken until it is written
+    row = &live_queue[queue_head * CHANNEL_IMAGE_NUM * LIVE_ROW_SIZE];
+    pthread_mutex_unlock( &live_lock );
+
+    //Files are only created once there is something to put in them
+    if( !opened )
+    {
+      Live_Open_Files();
+      opened = true;
+    }
+    Live_Write_Row( row );
+
+    pthread_mutex_lock( &live_lock );
+    queue_head = ( queue_head + 1 ) % LIVE_QUEUE_LEN;
+    queue_cnt--;
+    pthread_cond_signal( &live_freed );
+  }
+  pthread_mutex_unlock( &live_lock );
+
+  //Files that took every row are whole images
+  for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+    if( live_fp[idx] != NULL )
+    {
+      live_saved[idx] = ( fclose(live_fp[idx]) == 0 );
+      live_fp[idx] = NULL;
+    }
+
+  return( NULL );
+}
+
+/*****************************************************************************/
+
+/* Live_Enabled()
+ *
+ * Tells if raw channel images are to be saved as PGM, in which
+ * case they are written out row by row while they are decoded
+ */
+bool Live_Enabled(void) {
+  return( isFlagSet(IMAGE_RAW) &&
+      isFlagSet(IMAGE_SAVE_PPGM) &&
+      isFlagSet(IMAGE_OUT_SPLIT) );
+}
+
+/*****************************************************************************/
+
+bool Live_Active(void) {
+  return( live_active );
+}
+
+/*****************************************************************************/
+
+/* Live_Saved()
+ *
+ * Tells if the raw image of channel chn was written whole by
+ * the writer thread, once Live_Close() has returned. If not,
+ * it is left to be saved the usual way
+ */
+bool Live_Saved(uint32_t chn) {
+  return( !live_active && live_saved[chn] );
+}
+
+/*****************************************************************************/
+
+/* Live_Open()
+ *
+ * Starts the thread writing raw channel images, if enabled.
+ * The file names are made here, as File_Name() is not for
+ * use by other threads
+ */
+void Live_Open(void) {
+  uint32_t idx;
+
+  Live_Close();
+  memset( live_saved, 0, sizeof(live_saved) );
+  if( !Live_Enabled() ) return;
+
+  for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+  {
+    if( live_name[idx] == NULL )
+      mem_alloc( (void **)&live_name[idx], MAX_FILE_NAME );
+    live_name[idx][0] = '\0';
+    File_Name( live_name[idx], idx, "-raw.pgm" );
+  }
+
+  if( live_queue == NULL )
+    mem_alloc( (void **)&live_queue,
+        LIVE_QUEUE_LEN * CHANNEL_IMAGE_NUM * LIVE_ROW_SIZE );
+
+  queue_head = 0;
+  queue_cnt  = 0;
+  live_stop  = false;
+  if( pthread_create(&live_thread, NULL, Live_Writer, NULL) != 0 )
+  {
+    Print_Message( "Failed to start image writing thread", ERROR_MESG );
+    return;
+  }
+
+  live_active = true;
+}
+
+/*****************************************************************************/
+
+/* Live_Put_Row()
+ *
+ * Queues the next MCU row of the channel images for writing, from
+ * the LIVE_ROW_LINES lines at row[channel], or blank if that is
+ * NULL. Returns false if the queue is full, unless told to wait
+ */
+bool Live_Put_Row(uint8_t *const row[CHANNEL_IMAGE_NUM], bool wait) {
+  uint8_t *slot;
+  uint32_t idx;
+
+  pthread_mutex_lock( &live_lock );
+  while( wait && (queue_cnt == LIVE_QUEUE_LEN) )
+    pthread_cond_wait( &live_freed, &live_lock );
+  if( queue_cnt == LIVE_QUEUE_LEN )
+  {
+    pthread_mutex_unlock( &live_lock );
+    return( false );
+  }
+  slot = &live_queue[((queue_head + queue_cnt) % LIVE_QUEUE_LEN) *
+    CHANNEL_IMAGE_NUM * LIVE_ROW_SIZE];
+  pthread_mutex_unlock( &live_lock );
+
+  //Only the writer thread takes slots off the queue, so this one stays free
+  for( idx = 0; idx < CHANNEL_IMAGE_NUM; idx++ )
+    if( row[idx] != NULL )
+      memcpy( &slot[idx * LIVE_ROW_SIZE], row[idx], LIVE_ROW_SIZE );
+    else
+      memset( &slot[idx * LIVE_ROW_SIZE], 0, LIVE_ROW_SIZE );
+
+  pthread_mutex_lock( &live_lock );
+  queue_cnt++;
+  pthread_cond_signal( &live_filled );
+  pthread_mutex_unlock( &live_lock );
+
+  return( true );
+}
+
+/*****************************************************************************/
+
+/* Live_Close()
+ *
+ * Lets the writer thread finish the queued rows and close the files
+ */
+void Live_Close(void) {
+  if( !live_active ) return;
+
+  pthread_mutex_lock( &live_lock );
+  live_stop = true;
+  pthread_cond_signal( &live_filled );
+  pthread_mutex_unlock( &live_lock );
+
+  pthread_join( live_thread, NULL );
+  live_active = false;
+}
@@ -0,0 +1,43 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details:
+ *
+ *  http://www.gnu.org/copyleft/gpl.txt
+ */
+
+/*****************************************************************************/
+
+#ifndef MLRPT_LIVE_IMAGE_H
+#define MLRPT_LIVE_IMAGE_H
+
+/*****************************************************************************/
+
+#include "../common/common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*****************************************************************************/
+
+/* Image lines of an MCU row */
+#define LIVE_ROW_LINES  8
+
+/*****************************************************************************/
+
+bool Live_Enabled(void);
+bool Live_Active(void);
+bool Live_Saved(uint32_t chn);
+void Live_Open(void);
+bool Live_Put_Row(uint8_t *const row[CHANNEL_IMAGE_NUM], bool wait);
+void Live_Close(void);
+
+/*****************************************************************************/
+
+#endif
@@ -303,6 +303,21 @@ bool loadConfig(void) {
 
         if (!rc_data.decode_timer)
             rc_data.decode_timer = rc_data.default_timer;
+
+        if (config_setting_lookup_bool(set_v, "measure_ber", &int_v)) {
+            if (int_v)
+                SetFlag(DECODE_MEASURE_BER);
+            else
+                ClearFlag(DECODE_MEASURE_BER);
+        }
+        else
+            SetFlag(DECODE_MEASURE_BER);
+
+        if (config_setting_lookup_int(set_v, "threads", &int_v) &&
+                (int_v >= 0) && (int_v <= DECODE_THREADS_MAX))
+            rc_data.decode_threads = int_v;
+        else
+            rc_data.decode_threads = 1;
     }
     else {
         Print_Message("Can't find decoder settings!", ERROR_MESG);
@@ -545,6 +560,25 @@ bool loadConfig(void) {
         }
         else
             ClearFlag(IMAGE_RAW);
+
+        if (config_setting_lookup_bool(set_v, "jpeg_lossless", &int_v)) {
+            if (int_v)
+                SetFlag(IMAGE_JPEG_LOSSLESS);
+            else
+                ClearFlag(IMAGE_JPEG_LOSSLESS);
+        }
+        else
+            ClearFlag(IMAGE_JPEG_LOSSLESS);
+
+        if (config_setting_lookup_string(set_v, "cadu_out", &str_v))
+            strncpy(rc_data.cadu_out, str_v, PATH_MAX);
+        else
+            rc_data.cadu_out[0] = '\0';
+
+        if (config_setting_lookup_string(set_v, "vcdu_out", &str_v))
+            strncpy(rc_data.vcdu_out, str_v, PATH_MAX);
+        else
+            rc_data.vcdu_out[0] = '\0';
     }
     else {
         SetFlag(IMAGE_OUT_COMBO);
@@ -556,6 +590,10 @@ bool loadConfig(void) {
         rc_data.jpeg_quality = 100;
 
         ClearFlag(IMAGE_RAW);
+        ClearFlag(IMAGE_JPEG_LOSSLESS);
+
+        rc_data.cadu_out[0] = '\0';
+        rc_data.vcdu_out[0] = '\0';
     }
 
     /* Cleanup */
@@ -77,6 +77,9 @@ typedef struct rc_data_t {
     /* TODO why do we need uint32_t? */
     uint32_t decode_timer, default_timer;
 
+    /* Threads decoding image packets, 0 for one per CPU */
+    int decode_threads;
+
     /* Image normalization pixel value ranges */
     uint8_t norm_range[CHANNEL_IMAGE_NUM][2]; /* TODO should be exactly 3 */
 
@@ -91,6 +94,10 @@ typedef struct rc_data_t {
 
     /* JPEG image quality */
     int jpeg_quality;
+
+    /* CADU and VCDU stream outputs (files or "unix:" sockets),
+     * empty if not used */
+    char cadu_out[PATH_MAX + 1], vcdu_out[PATH_MAX + 1];
 } rc_data_t;
 
 /*****************************************************************************/
@@ -43,6 +43,9 @@ static const char *Filename(const char *fpath);
 /* An int variable holding the single-bit flags */
 static int Flags = 0;
 
+/* Date and time put in the names of the files of a pass */
+static time_t file_time = 0;
+
 /*****************************************************************************/
 
 /* prepareCacheDirectory
@@ -119,6 +122,17 @@ static bool mkdirRecurse(const char *path) {
 
 /*****************************************************************************/
 
+/* File_Time_Stamp()
+ *
+ * Takes the date and time that File_Name() puts in file
+ * names, so that all the files of a pass get the same one
+ */
+void File_Time_Stamp(void) {
+  time( &file_time );
+}
+
+/*****************************************************************************/
+
 /* File_Name()
  *
  * Prepare a file name, use date and time if null argument
@@ -130,13 +144,13 @@ void File_Name(char *file_name, uint32_t chn, const char *ext) {
   if( strlen(file_name) == 0 )
   {
     /* Variables for reading time (UTC) */
-    time_t tp;
+    time_t tp = file_time;
     struct tm utc;
     char tim[20];
 
     /* Prepare file name as UTC date-time. Default path is images/ */
-    time( &tp );
-    utc = *gmtime( &tp );
+    if( tp == 0 ) time( &tp );
+    gmtime_r( &tp, &utc );
     strftime( tim, sizeof(tim), "%Y%m%d-%H%M%S", &utc );
 
     /* TODO possibly dangerous because of system string length limits */